@@ -3,12 +3,28 @@
 #include <vector>
 #include <fstream>
 #include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <mutex>
+#include <thread>
 
 // Include the headers for all our new modules
 #include "bencode.h"
 #include "torrent_file.h"
 #include "tracker.h"
 #include "peer_connection.h"
+#include "thread_pool.h"
+#include "hash_verifier.h"
+#include "mapped_file.h"
+#include "recheck.h"
+#include "resume_data.h"
+#include "storage.h"
+#include "uring_storage.h"
+#include "disk_io.h"
+#include "piece_manager.h"
+#include "swarm.h"
 
 // --- Helper function to parse peer IP and Port ---
 // This remains a useful utility for main.
@@ -24,6 +40,376 @@ std::pair<std::string, int> parsePeerInfo(const std::string &peerInfo)
     return {ip, port};
 }
 
+// --- Helpers for the batch 'info' mode ---
+
+// Expands each source into torrent paths: directories are searched
+// recursively for *.torrent files, anything else is read as a list file
+// with one path per line.
+std::vector<std::string> collectTorrentPaths(const std::vector<std::string> &sources)
+{
+    namespace fs = std::filesystem;
+    std::vector<std::string> paths;
+    for (const std::string &source : sources)
+    {
+        if (fs::is_directory(source))
+        {
+            for (const auto &entry : fs::recursive_directory_iterator(source))
+            {
+                if (entry.is_regular_file() && entry.path().extension() == ".torrent")
+                {
+                    paths.push_back(entry.path().string());
+                }
+            }
+            continue;
+        }
+
+        std::ifstream list(source);
+        if (!list)
+        {
+            throw std::runtime_error("Cannot open directory or file list: " + source);
+        }
+        std::string line;
+        while (std::getline(list, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (!line.empty())
+                paths.push_back(line);
+        }
+    }
+    return paths;
+}
+
+// Loads and hashes every torrent on a thread pool. Prints one JSON record per
+// file as it completes, then a summary record with the overall throughput.
+int runBatchInfo(const std::vector<std::string> &sources, size_t threadCount)
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<std::string> paths = collectTorrentPaths(sources);
+    std::mutex outputMutex;
+    size_t succeeded = 0;
+    uintmax_t totalBytes = 0;
+
+    auto start = Clock::now();
+    {
+        ThreadPool pool(threadCount);
+        for (const std::string &path : paths)
+        {
+            pool.submit([&, path]
+                        {
+                auto fileStart = Clock::now();
+                TorrentFile torrent;
+                bool ok = torrent.loadFromFile(path);
+                double ms = std::chrono::duration<double, std::milli>(Clock::now() - fileStart).count();
+
+                std::error_code ec;
+                uintmax_t bytes = std::filesystem::file_size(path, ec);
+                if (ec)
+                    bytes = 0;
+
+                nlohmann::json record = {{"file", path}, {"ok", ok}, {"bytes", bytes}, {"ms", ms}};
+                if (ok)
+                {
+                    record["info_hash"] = torrent.getInfoHashHex();
+                    record["name"] = torrent.getFileName();
+                    record["length"] = torrent.getFileLength();
+                    record["piece_length"] = torrent.getPieceLength();
+                    record["pieces"] = torrent.getNumPieces();
+                }
+                // Names and paths in older torrents are often not UTF-8; replace
+                // the bad bytes rather than lose the record.
+                std::string line = record.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+
+                std::lock_guard<std::mutex> lock(outputMutex);
+                std::cout << line << '\n';
+                if (ok)
+                    succeeded++;
+                totalBytes += bytes; });
+        }
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    nlohmann::json summary = {
+        {"summary", true},
+        {"files", paths.size()},
+        {"ok", succeeded},
+        {"failed", paths.size() - succeeded},
+        {"bytes", totalBytes},
+        {"threads", threadCount},
+        {"seconds", seconds},
+        {"files_per_second", seconds > 0 ? paths.size() / seconds : 0.0},
+        {"mb_per_second", seconds > 0 ? totalBytes / seconds / (1024.0 * 1024.0) : 0.0}};
+    std::cout << summary.dump() << std::endl;
+
+    return succeeded == paths.size() ? 0 : 1;
+}
+
+// Formats the indices whose flag equals `value` as ranges, e.g. "0-3, 7, 9-12".
+std::string describePieceRanges(const std::vector<bool> &pieces, bool value)
+{
+    std::string text;
+    size_t i = 0;
+    while (i < pieces.size())
+    {
+        if (pieces[i] != value)
+        {
+            ++i;
+            continue;
+        }
+        size_t first = i;
+        while (i < pieces.size() && pieces[i] == value)
+        {
+            ++i;
+        }
+        if (!text.empty())
+            text += ", ";
+        text += std::to_string(first);
+        if (i - 1 > first)
+            text += "-" + std::to_string(i - 1);
+    }
+    return text;
+}
+
+// Records which pieces of `dataPath` are complete, stamped with the file's
+// current size and mtime, so the next start can skip rehashing it.
+void writeResumeRecord(const TorrentFile &torrent, const std::string &dataPath, const std::vector<bool> &pieces)
+{
+    std::optional<ResumeData::FileStamp> stamp = ResumeData::stampFile(dataPath);
+    if (!stamp)
+        return;
+
+    ResumeData resume;
+    resume.infoHash = torrent.getInfoHashBinary();
+    resume.pieces = pieces;
+    resume.files.push_back(*stamp);
+    if (!resume.saveToFile(ResumeData::pathFor(dataPath)))
+    {
+        std::cerr << "Warning: Could not write resume record for " << dataPath << std::endl;
+    }
+}
+
+// --- The 'download' command ---
+
+// Downloads `torrentFilePath` into `outputFile`. Pieces already present from
+// an earlier run are kept, and each new piece goes to the disk threads as
+// soon as it passes verification, so memory use is bounded by the pieces in
+// flight plus the write-back cache, and an interruption loses at most those.
+// `allocation` decides how the output file's space is set up before the
+// first write (see AllocationMode), `backend` how pieces reach it, and
+// `network` how the reactor threads drive the peer sockets.
+int runDownload(const std::string &outputFile, const std::string &torrentFilePath, AllocationMode allocation,
+                StorageBackend backend, EventLoop::Backend network)
+{
+    using Clock = std::chrono::steady_clock;
+
+    // 1. Load torrent file metadata
+    TorrentFile torrent;
+    if (!torrent.loadFromFile(torrentFilePath))
+        return 1;
+
+    // 2. Find out which pieces a previous run already left in the output file
+    size_t hashThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<bool> have(torrent.getNumPieces(), false);
+    {
+        MappedFile existing;
+        if (existing.open(outputFile))
+        {
+            // A resume record is trusted as long as the file is exactly as it
+            // was when the record was written; otherwise the data is rehashed.
+            std::string resumePath = ResumeData::pathFor(outputFile);
+            std::optional<ResumeData::FileStamp> stamp = ResumeData::stampFile(outputFile);
+            ResumeData resume;
+            if (stamp && resume.loadFromFile(resumePath) && resume.infoHash == torrent.getInfoHashBinary() &&
+                resume.pieces.size() == have.size() && resume.files.size() == 1 && resume.files[0] == *stamp)
+            {
+                std::cout << "Using resume record " << resumePath << std::endl;
+                have = resume.pieces;
+            }
+            else
+            {
+                have = recheckPieces(torrent, existing.view(), hashThreads);
+                writeResumeRecord(torrent, outputFile, have);
+            }
+        }
+    }
+
+    PiecePicker picker(torrent.getNumPieces());
+    for (size_t i = 0; i < torrent.getNumPieces(); ++i)
+    {
+        if (!have[i])
+            picker.want(i);
+    }
+    if (picker.wantedCount() < have.size())
+    {
+        std::cout << "Resuming: " << have.size() - picker.wantedCount() << " of " << have.size() << " pieces already present." << std::endl;
+    }
+    if (picker.wantedCount() == 0)
+    {
+        std::cout << "All pieces already present in " << outputFile << std::endl;
+        return 0;
+    }
+
+    if (backend == StorageBackend::Uring && !UringStorage::available())
+    {
+        std::cerr << "Warning: io_uring is not available; using pwrite instead." << std::endl;
+        backend = StorageBackend::Pwrite;
+    }
+    std::unique_ptr<Storage> storage = makeStorage(backend);
+    if (!storage->open(outputFile, torrent.getFileLength(), allocation))
+        return 1; // Error message was already printed by open
+    DiskIO::Options diskOptions;
+    if (backend == StorageBackend::Mmap)
+    {
+        // Copying into the mapping is cheap and the page cache already batches
+        // the write-back, so merging pieces first would only add copies.
+        diskOptions.threads = 1;
+        diskOptions.writeSize = 0;
+    }
+    else if (backend == StorageBackend::Uring)
+    {
+        // The ring keeps a whole batch in flight; one submitting thread is enough.
+        diskOptions.threads = 1;
+    }
+    DiskIO disk(*storage, diskOptions);
+
+    // 3. Get peer list from tracker
+    Tracker tracker;
+    std::string peerId = "00112233445566778899";
+    uint16_t port = 6881;
+    std::vector<std::string> peers = tracker.getPeers(torrent, peerId, port);
+    if (peers.empty())
+        throw std::runtime_error("No peers found.");
+
+    // 4. Download the missing pieces from every peer at once, rarest first.
+    // The reactor threads hash each piece as its blocks arrive, so checking
+    // it is only a compare. Verified pieces go to the disk threads; pieces
+    // that fail verification are fetched again.
+    const int MAX_ATTEMPTS = 3;
+    const auto RESUME_INTERVAL = std::chrono::seconds(10);
+    // How long to wait while no connected peer has any piece still needed,
+    // first before asking the tracker for more peers, then before giving up.
+    const auto STALL_TIMEOUT = std::chrono::seconds(30);
+    HashVerifier verifier(torrent);
+    std::vector<int> attempts(torrent.getNumPieces(), 0);
+    size_t completed = have.size() - picker.wantedCount();
+    auto lastResumeWrite = Clock::now();
+    auto stalledSince = Clock::now(); // start of the current stall, if any
+    bool reannounced = false;
+
+    Swarm::Callbacks callbacks;
+    callbacks.onPiece = [&](size_t index, std::vector<uint8_t> data, std::string digest)
+    { verifier.submit(index, std::move(data), digest); };
+    // One reactor thread per core, like the recheck workers.
+    Swarm::Options swarmOptions;
+    swarmOptions.shards = hashThreads;
+    if (network == EventLoop::Backend::Ring && !EventLoop::ringAvailable())
+    {
+        std::cerr << "Warning: io_uring socket I/O is not available; using poll instead." << std::endl;
+        network = EventLoop::Backend::Readiness;
+    }
+    swarmOptions.network = network;
+    Swarm swarm(torrent, peerId, swarmOptions, picker, std::move(callbacks));
+    for (const std::string &peerInfo : peers)
+    {
+        auto [peerIp, peerPort] = parsePeerInfo(peerInfo);
+        swarm.addPeer(peerIp, peerPort);
+    }
+
+    // The resume record may only claim pieces that are safely on disk.
+    auto checkpoint = [&]
+    {
+        disk.flush();
+        writeResumeRecord(torrent, outputFile, have);
+        lastResumeWrite = Clock::now();
+    };
+
+    auto collect = [&](HashVerifier::Completion completion)
+    {
+        size_t index = completion.pieceIndex;
+        if (!completion.valid)
+        {
+            if (++attempts[index] >= MAX_ATTEMPTS)
+            {
+                throw std::runtime_error("Piece " + std::to_string(index) + " failed verification too many times.");
+            }
+            std::cerr << "Piece " << index << " failed verification, fetching it again." << std::endl;
+            picker.want(index);
+            swarm.assignWork();
+            return;
+        }
+        disk.write(static_cast<uint64_t>(index) * torrent.getPieceLength(), std::move(completion.data));
+        have[index] = true;
+        ++completed;
+        reannounced = false; // a later stall gets its own re-announce
+        std::cout << "\rDownloaded " << completed << "/" << have.size() << " pieces from "
+                  << swarm.connectionCount() << " peer(s)" << std::flush;
+        if (Clock::now() - lastResumeWrite >= RESUME_INTERVAL)
+        {
+            checkpoint();
+        }
+    };
+
+    try
+    {
+        while (picker.wantedCount() > 0 || picker.inFlightCount() > 0)
+        {
+            if (swarm.connectionCount() == 0 && picker.inFlightCount() == 0)
+            {
+                throw std::runtime_error("No peers left to download from.");
+            }
+            bool stalled = picker.inFlightCount() == 0 && !picker.wantedAvailable();
+            if (!stalled)
+            {
+                stalledSince = Clock::now();
+            }
+            else if (Clock::now() - stalledSince >= STALL_TIMEOUT)
+            {
+                if (reannounced)
+                    throw std::runtime_error("No connected peer has the remaining pieces.");
+                std::cerr << "\nNo connected peer has the remaining pieces; asking the tracker for more." << std::endl;
+                for (const std::string &peerInfo : tracker.getPeers(torrent, peerId, port))
+                {
+                    auto [peerIp, peerPort] = parsePeerInfo(peerInfo);
+                    swarm.addPeer(peerIp, peerPort);
+                }
+                reannounced = true;
+                stalledSince = Clock::now();
+            }
+            swarm.poll(std::chrono::milliseconds(500));
+            while (std::optional<HashVerifier::Completion> completion = verifier.poll())
+            {
+                collect(std::move(*completion));
+            }
+        }
+        std::cout << std::endl;
+        if (swarm.duplicateBytes() > 0 || swarm.handedOverBytes() > 0)
+        {
+            std::cout << "Endgame: " << swarm.duplicateBytes() << " duplicate bytes received, "
+                      << swarm.handedOverBytes() << " bytes handed over between peers." << std::endl;
+        }
+    }
+    catch (const std::exception &)
+    {
+        // Keep what made it to disk so the next run resumes from there.
+        try
+        {
+            checkpoint();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Warning: " << e.what() << std::endl;
+        }
+        throw;
+    }
+
+    // 5. Make sure everything is on disk before declaring the download done
+    disk.flush();
+    writeResumeRecord(torrent, outputFile, have);
+    std::cout << "Download complete. File saved to: " << outputFile << std::endl;
+    return 0;
+}
+
 // --- Main Application Logic ---
 int main(int argc, char *argv[])
 {
@@ -31,6 +417,12 @@ int main(int argc, char *argv[])
     std::cout << std::unitbuf;
     std::cerr << std::unitbuf;
 
+#ifndef _WIN32
+    // A peer closing its socket must surface as a failed send, not kill the
+    // process before it can record what it has downloaded.
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+
     if (argc < 2)
     {
         std::cerr << "Usage: ./your_client <command> [args...]" << std::endl;
@@ -49,6 +441,22 @@ int main(int argc, char *argv[])
             nlohmann::json decoded = Bencode::decode_bencoded_value(argv[2]);
             std::cout << decoded.dump() << std::endl;
         }
+        else if (command == "info" && argc >= 3 && std::string(argv[2]) == "--batch")
+        {
+            // Usage: ./your_client info --batch [-j <threads>] <directory|list_file>...
+            size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+            int argIndex = 3;
+            if (argIndex + 1 < argc && std::string(argv[argIndex]) == "-j")
+            {
+                threadCount = std::max<size_t>(1, std::stoul(argv[argIndex + 1]));
+                argIndex += 2;
+            }
+            if (argIndex >= argc)
+                throw std::runtime_error("Usage: ./your_client info --batch [-j <threads>] <directory|list_file>...");
+
+            std::vector<std::string> sources(argv + argIndex, argv + argc);
+            return runBatchInfo(sources, threadCount);
+        }
         else if (command == "info")
         {
             if (argc < 3)
@@ -83,58 +491,69 @@ int main(int argc, char *argv[])
                 std::cout << p << std::endl;
             }
         }
-        else if (command == "download")
+        else if (command == "recheck")
         {
-            if (argc < 5 || std::string(argv[2]) != "-o")
+            // Usage: ./your_client recheck [-j <threads>] <torrent_file> <data_file>
+            size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+            int argIndex = 2;
+            if (argIndex + 1 < argc && std::string(argv[argIndex]) == "-j")
             {
-                throw std::runtime_error("Usage: ./your_client download -o <output_file> <torrent_file>");
+                threadCount = std::max<size_t>(1, std::stoul(argv[argIndex + 1]));
+                argIndex += 2;
             }
-            std::string outputFile = argv[3];
-            std::string torrentFilePath = argv[4];
+            if (argIndex + 2 != argc)
+                throw std::runtime_error("Usage: ./your_client recheck [-j <threads>] <torrent_file> <data_file>");
 
-            // 1. Load torrent file metadata
             TorrentFile torrent;
-            if (!torrent.loadFromFile(torrentFilePath))
+            if (!torrent.loadFromFile(argv[argIndex]))
                 return 1;
 
-            // 2. Get peer list from tracker
-            Tracker tracker;
-            std::string peerId = "00112233445566778899";
-            uint16_t port = 6881;
-            std::vector<std::string> peers = tracker.getPeers(torrent, peerId, port);
-            if (peers.empty())
-                throw std::runtime_error("No peers found.");
+            MappedFile content;
+            if (!content.open(argv[argIndex + 1]))
+                throw std::runtime_error(std::string("Cannot open data file: ") + argv[argIndex + 1]);
 
-            // 3. Connect to the first available peer
-            // NOTE: A more robust client would try multiple peers if one fails.
-            auto [peerIp, peerPort] = parsePeerInfo(peers[0]);
-            PeerConnection peer(peerIp, peerPort, torrent, peerId);
+            auto start = std::chrono::steady_clock::now();
+            std::vector<bool> have = recheckPieces(torrent, content.view(), threadCount);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-            if (!peer.connectAndHandshake())
+            size_t valid = std::count(have.begin(), have.end(), true);
+            std::cout << "Valid pieces: " << valid << "/" << have.size() << std::endl;
+            if (valid < have.size())
             {
-                throw std::runtime_error("Failed to connect and handshake with peer " + peers[0]);
+                std::cout << "Missing pieces: " << describePieceRanges(have, false) << std::endl;
             }
-
-            // 4. Download all pieces sequentially
-            std::vector<uint8_t> fullFileData;
-            fullFileData.reserve(torrent.getFileLength());
-
-            for (size_t i = 0; i < torrent.getNumPieces(); ++i)
+            std::cout << "Checked " << content.size() << " bytes in " << seconds << " s using "
+                      << threadCount << " thread(s)" << std::endl;
+        }
+        else if (command == "download")
+        {
+            // Usage: ./your_client download [--alloc full|sparse|none] [--storage pwrite|mmap|uring] [--net poll|uring] -o <output_file> <torrent_file>
+            const char *usage = "Usage: ./your_client download [--alloc full|sparse|none] [--storage pwrite|mmap|uring] [--net poll|uring] -o <output_file> <torrent_file>";
+            AllocationMode allocation = AllocationMode::Sparse;
+            StorageBackend backend = StorageBackend::Pwrite;
+            EventLoop::Backend network = EventLoop::Backend::Readiness;
+            std::string outputFile;
+            int argIndex = 2;
+            while (argIndex + 1 < argc)
             {
-                std::vector<uint8_t> pieceData = peer.downloadPiece(i);
-                fullFileData.insert(fullFileData.end(), pieceData.begin(), pieceData.end());
+                std::string option = argv[argIndex];
+                if (option == "--alloc")
+                    allocation = parseAllocationMode(argv[argIndex + 1]);
+                else if (option == "--storage")
+                    backend = parseStorageBackend(argv[argIndex + 1]);
+                else if (option == "--net")
+                    network = parseEventLoopBackend(argv[argIndex + 1]);
+                else if (option == "-o")
+                    outputFile = argv[argIndex + 1];
+                else
+                    break;
+                argIndex += 2;
             }
+            if (outputFile.empty() || argIndex + 1 != argc)
+                throw std::runtime_error(usage);
+            std::string torrentFilePath = argv[argIndex];
 
-            peer.disconnect();
-
-            // 5. Write the complete file to disk
-            std::cout << "Download complete. Writing to file: " << outputFile << std::endl;
-            std::ofstream outFileStream(outputFile, std::ios::binary);
-            if (!outFileStream.write(reinterpret_cast<const char *>(fullFileData.data()), fullFileData.size()))
-            {
-                throw std::runtime_error("Failed to write to output file.");
-            }
-            std::cout << "File saved successfully." << std::endl;
+            return runDownload(outputFile, torrentFilePath, allocation, backend, network);
         }
         else
         {
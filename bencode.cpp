@@ -1,7 +1,9 @@
 #include "bencode.h"
 #include <cctype>
+#include <cstring>
+#include <charconv>
+#include <algorithm>
 #include <stdexcept>
-#include <sstream>
 
 // Anonymous namespace to keep helper functions private to this file
 namespace
@@ -124,40 +126,650 @@ namespace Bencode
         return result;
     }
 
-    // FIX: This function is now correctly placed inside the Bencode namespace
     std::string json_to_bencode(const nlohmann::json &js)
     {
-        std::ostringstream os;
-        if (js.is_object())
+        std::string out;
+        out.reserve(encoded_size(js));
+        append_bencode(js, out);
+        return out;
+    }
+
+    void append_bencode(const nlohmann::json &js, std::string &out)
+    {
+        struct StringSink
+        {
+            std::string &out;
+            void put(char c) { out += c; }
+            void write(const char *data, size_t length) { out.append(data, length); }
+        } sink{out};
+        detail::encode_into(js, sink);
+    }
+
+    size_t encoded_size(const nlohmann::json &js)
+    {
+        // Counts bytes instead of writing them, so sizing shares the exact
+        // code path that does the encoding.
+        struct CountingSink
+        {
+            size_t size = 0;
+            void put(char) { size++; }
+            void write(const char *, size_t length) { size += length; }
+        } sink;
+        detail::encode_into(js, sink);
+        return sink.size;
+    }
+}
+
+
+// --- Zero-copy document parser ---
+namespace Bencode
+{
+    void *Arena::allocate(size_t size, size_t alignment)
+    {
+        size_t padding = m_current ? (alignment - reinterpret_cast<uintptr_t>(m_current) % alignment) % alignment : 0;
+        if (m_current == nullptr || padding + size > m_remaining)
         {
-            os << 'd';
-            for (auto &el : js.items())
+            // Blocks double in size, so even a large document needs only a handful of them.
+            size_t blockSize = std::max(m_nextBlockSize, size + alignment);
+            m_nextBlockSize = blockSize * 2;
+            m_blocks.emplace_back(new char[blockSize]);
+            m_current = m_blocks.back().get();
+            m_remaining = blockSize;
+            padding = (alignment - reinterpret_cast<uintptr_t>(m_current) % alignment) % alignment;
+        }
+
+        void *result = m_current + padding;
+        m_current += padding + size;
+        m_remaining -= padding + size;
+        return result;
+    }
+
+    long long Node::asInteger() const
+    {
+        if (m_type != Type::Integer)
+            throw std::runtime_error("Bencode node is not an integer.");
+        return m_integer;
+    }
+
+    std::string_view Node::asString() const
+    {
+        if (m_type != Type::String)
+            throw std::runtime_error("Bencode node is not a string.");
+        return std::string_view(m_string, m_size);
+    }
+
+    size_t Node::size() const
+    {
+        if (m_type != Type::List && m_type != Type::Dict)
+            throw std::runtime_error("Bencode node is not a list or dictionary.");
+        return m_size;
+    }
+
+    const Node &Node::operator[](size_t index) const
+    {
+        if (m_type != Type::List)
+            throw std::runtime_error("Bencode node is not a list.");
+        if (index >= m_size)
+            throw std::out_of_range("Bencode list index out of range.");
+        return m_children[index];
+    }
+
+    std::string_view Node::keyAt(size_t index) const
+    {
+        if (m_type != Type::Dict)
+            throw std::runtime_error("Bencode node is not a dictionary.");
+        if (index >= m_size)
+            throw std::out_of_range("Bencode dictionary index out of range.");
+        return m_children[2 * index].asString();
+    }
+
+    const Node &Node::valueAt(size_t index) const
+    {
+        if (m_type != Type::Dict)
+            throw std::runtime_error("Bencode node is not a dictionary.");
+        if (index >= m_size)
+            throw std::out_of_range("Bencode dictionary index out of range.");
+        return m_children[2 * index + 1];
+    }
+
+    const Node *Node::find(std::string_view key) const
+    {
+        if (m_type != Type::Dict)
+            throw std::runtime_error("Bencode node is not a dictionary.");
+        for (size_t i = 0; i < m_size; ++i)
+        {
+            if (m_children[2 * i].asString() == key)
+                return &m_children[2 * i + 1];
+        }
+        return nullptr;
+    }
+
+    // Builds a Document without recursion from the structural index: finished
+    // values are collected on a scratch stack and each container's children are
+    // moved into the arena as one contiguous array once its closing 'e' is seen.
+    class DocumentBuilder
+    {
+    public:
+        explicit DocumentBuilder(std::string_view input) : m_input(input) {}
+
+        Document build()
+        {
+            Document document;
+            m_structurals = build_structural_index(m_input);
+
+            // Every node starts at one or more structural bytes, so the index
+            // size bounds the node count and the arena needs a single block.
+            size_t maxNodes = m_structurals.offsets.size() + 1;
+            document.m_arena.reserve(maxNodes * sizeof(Node) + alignof(Node));
+            while (true)
             {
-                os << el.key().size() << ':' << el.key();
-                // The recursive call must also use the full, original name
-                os << Bencode::json_to_bencode(el.value());
+                if (m_index >= m_input.size())
+                    throw std::runtime_error("Invalid bencode: unexpected end of input.");
+
+                // Values are told apart by their first byte, as in the byte-by-byte
+                // parser; the index only saves searching for the delimiters.
+                char c = m_input[m_index];
+                if (c == 'l' || c == 'd')
+                {
+                    m_frames.push_back({c == 'd' ? Node::Type::Dict : Node::Type::List, m_values.size(), m_index});
+                    m_index++;
+                    m_next++;
+                    continue;
+                }
+
+                size_t start = m_index;
+                Node node;
+                if (c == 'e')
+                {
+                    if (m_frames.empty())
+                        throw std::runtime_error("Unhandled bencoded value type.");
+                    node = closeContainer(document.m_arena);
+                }
+                else if (c == 'i')
+                {
+                    node = parseInteger();
+                }
+                else if (std::isdigit(static_cast<unsigned char>(c)))
+                {
+                    node = parseString();
+                }
+                else
+                {
+                    throw std::runtime_error("Unhandled bencoded value type.");
+                }
+
+                if (c != 'e')
+                {
+                    node.m_raw = m_input.data() + start;
+                    node.m_rawSize = m_index - start;
+                }
+
+                if (m_frames.empty())
+                {
+                    Node *root = document.m_arena.allocateArray<Node>(1);
+                    *root = node;
+                    document.m_root = root;
+                    break;
+                }
+
+                const Frame &frame = m_frames.back();
+                if (frame.type == Node::Type::Dict && (m_values.size() - frame.firstValue) % 2 == 0 && !node.isString())
+                {
+                    throw std::runtime_error("Invalid bencoded dictionary: key is not a string.");
+                }
+                m_values.push_back(node);
+            }
+
+            if (m_index != m_input.size())
+            {
+                throw std::runtime_error("Bencode string not fully consumed. Extra data at end.");
             }
-            os << 'e';
+            return document;
         }
-        else if (js.is_array())
+
+    private:
+        struct Frame
+        {
+            Node::Type type;
+            size_t firstValue;
+            size_t start; // input offset of the opening 'l' or 'd'
+        };
+
+        // Position of the first `delimiter` at or after m_index. In valid input
+        // it is the next index entry; otherwise searching the bytes gives the
+        // position the byte-by-byte parser would have found, so errors match.
+        size_t findDelimiter(char delimiter)
         {
-            os << 'l';
-            for (const auto &item : js)
+            if (m_next < m_structurals.offsets.size() && m_input[m_structurals.offsets[m_next]] == delimiter)
+                return m_structurals.offsets[m_next++];
+            return m_input.find(delimiter, m_index);
+        }
+
+        Node parseInteger()
+        {
+            m_index++; // Skip 'i'
+            m_next++;
+            size_t end_pos = findDelimiter('e');
+            if (end_pos == std::string_view::npos)
+            {
+                throw std::runtime_error("Invalid bencoded integer: missing 'e'.");
+            }
+
+            Node node;
+            node.m_type = Node::Type::Integer;
+            auto result = std::from_chars(m_input.data() + m_index, m_input.data() + end_pos, node.m_integer);
+            if (result.ec != std::errc() || result.ptr != m_input.data() + end_pos)
             {
-                // The recursive call must also use the full, original name
-                os << Bencode::json_to_bencode(item);
+                throw std::runtime_error("Invalid bencoded integer.");
             }
-            os << 'e';
+            m_index = end_pos + 1;
+            return node;
+        }
+
+        Node parseString()
+        {
+            size_t colon_pos = findDelimiter(':');
+            if (colon_pos == std::string_view::npos)
+            {
+                throw std::runtime_error("Invalid bencoded string: missing colon.");
+            }
+
+            size_t length = 0;
+            auto result = std::from_chars(m_input.data() + m_index, m_input.data() + colon_pos, length);
+            if (result.ec != std::errc() || result.ptr != m_input.data() + colon_pos)
+            {
+                throw std::runtime_error("Invalid bencoded string: bad length.");
+            }
+            m_index = colon_pos + 1;
+
+            if (length > m_input.size() - m_index)
+            {
+                throw std::runtime_error("Invalid bencoded string: length exceeds buffer size.");
+            }
+
+            Node node;
+            node.m_type = Node::Type::String;
+            node.m_string = m_input.data() + m_index;
+            node.m_size = length;
+            m_index += length;
+            return node;
         }
-        else if (js.is_number_integer())
+
+        Node closeContainer(Arena &arena)
         {
-            os << 'i' << js.get<long long>() << 'e';
+            m_index++; // Skip 'e'
+            m_next++;
+            Frame frame = m_frames.back();
+            m_frames.pop_back();
+
+            size_t count = m_values.size() - frame.firstValue;
+            if (frame.type == Node::Type::Dict && count % 2 != 0)
+            {
+                throw std::runtime_error("Invalid bencoded dictionary: key without value.");
+            }
+
+            Node *children = nullptr;
+            if (count > 0)
+            {
+                children = arena.allocateArray<Node>(count);
+                std::copy(m_values.begin() + frame.firstValue, m_values.end(), children);
+                m_values.resize(frame.firstValue);
+            }
+
+            Node node;
+            node.m_type = frame.type;
+            node.m_children = children;
+            node.m_size = frame.type == Node::Type::Dict ? count / 2 : count;
+            node.m_raw = m_input.data() + frame.start;
+            node.m_rawSize = m_index - frame.start;
+            return node;
         }
-        else if (js.is_string())
+
+        std::string_view m_input;
+        size_t m_index = 0;
+        StructuralIndex m_structurals;
+        size_t m_next = 0; // next entry of m_structurals to consume
+        std::vector<Node> m_values;
+        std::vector<Frame> m_frames;
+    };
+
+    Document parse_document(std::string_view encoded_value)
+    {
+        return DocumentBuilder(encoded_value).build();
+    }
+}
+
+// --- Streaming decoder ---
+namespace Bencode
+{
+    namespace
+    {
+        // Generous upper bounds; anything longer is not a sane key or number.
+        const size_t MAX_KEY_LENGTH = 4096;
+        const size_t MAX_DIGITS = 20;
+        const size_t MAX_DEPTH = 256;
+    }
+
+    StreamDecoder::StreamDecoder(EventHandler &handler) : m_handler(handler) {}
+
+    void StreamDecoder::feed(const char *data, size_t length)
+    {
+        size_t index = 0;
+        while (index < length)
         {
-            const std::string &value = js.get<std::string>();
-            os << value.size() << ':' << value;
+            switch (m_state)
+            {
+            case State::Value:
+                beginValue(data[index++]);
+                break;
+
+            case State::StringLength:
+            case State::Integer:
+            {
+                char c = data[index++];
+                char terminator = m_state == State::Integer ? 'e' : ':';
+                if (c != terminator)
+                {
+                    if (m_token.size() >= MAX_DIGITS)
+                        throw std::runtime_error("Invalid bencode: number too long.");
+                    m_token += c;
+                    break;
+                }
+
+                if (m_state == State::Integer)
+                {
+                    long long value = 0;
+                    auto result = std::from_chars(m_token.data(), m_token.data() + m_token.size(), value);
+                    if (result.ec != std::errc() || result.ptr != m_token.data() + m_token.size())
+                        throw std::runtime_error("Invalid bencoded integer.");
+                    m_handler.integer(value);
+                    endValue();
+                    break;
+                }
+
+                auto result = std::from_chars(m_token.data(), m_token.data() + m_token.size(), m_remaining);
+                if (result.ec != std::errc() || result.ptr != m_token.data() + m_token.size())
+                    throw std::runtime_error("Invalid bencoded string: bad length.");
+                m_token.clear();
+                if (m_readingKey && m_remaining > MAX_KEY_LENGTH)
+                    throw std::runtime_error("Invalid bencoded dictionary: key too long.");
+
+                m_state = State::StringData;
+                if (m_remaining == 0)
+                {
+                    if (m_readingKey)
+                        m_handler.key(std::string_view());
+                    else
+                        m_handler.bytes(std::string_view(), 0);
+                    endValue();
+                }
+                break;
+            }
+
+            case State::StringData:
+            {
+                size_t take = std::min(m_remaining, length - index);
+                std::string_view fragment(data + index, take);
+                index += take;
+                m_remaining -= take;
+
+                if (m_readingKey)
+                {
+                    m_token.append(fragment);
+                    if (m_remaining == 0)
+                    {
+                        m_handler.key(m_token);
+                        endValue();
+                    }
+                }
+                else
+                {
+                    m_handler.bytes(fragment, m_remaining);
+                    if (m_remaining == 0)
+                        endValue();
+                }
+                break;
+            }
+
+            case State::Done:
+                throw std::runtime_error("Bencode string not fully consumed. Extra data at end.");
+            }
+        }
+    }
+
+    void StreamDecoder::finish() const
+    {
+        if (m_state != State::Done)
+        {
+            throw std::runtime_error("Invalid bencode: unexpected end of input.");
+        }
+    }
+
+    void StreamDecoder::beginValue(char c)
+    {
+        if (c == 'e' && !m_containers.empty() && (m_containers.back() == 'l' || m_expectKey))
+        {
+            m_containers.pop_back();
+            m_handler.end();
+            m_expectKey = false;
+            endValue();
+            return;
+        }
+
+        if (m_expectKey && !std::isdigit(static_cast<unsigned char>(c)))
+        {
+            throw std::runtime_error("Invalid bencoded dictionary: key is not a string.");
+        }
+
+        m_token.clear();
+        m_readingKey = m_expectKey;
+        if (std::isdigit(static_cast<unsigned char>(c)))
+        {
+            m_token += c;
+            m_state = State::StringLength;
+        }
+        else if (c == 'i')
+        {
+            m_state = State::Integer;
+        }
+        else if (c == 'l' || c == 'd')
+        {
+            if (m_containers.size() >= MAX_DEPTH)
+                throw std::runtime_error("Invalid bencode: nesting too deep.");
+            m_containers.push_back(c);
+            m_expectKey = c == 'd';
+            if (c == 'd')
+                m_handler.beginDict();
+            else
+                m_handler.beginList();
+        }
+        else
+        {
+            throw std::runtime_error("Unhandled bencoded value type.");
+        }
+    }
+
+    // Called whenever a key or a complete value has been read.
+    void StreamDecoder::endValue()
+    {
+        m_token.clear();
+        if (m_readingKey)
+        {
+            m_readingKey = false;
+            m_expectKey = false;
+            m_state = State::Value;
+            return;
+        }
+
+        if (m_containers.empty())
+        {
+            m_state = State::Done;
+            return;
+        }
+        m_expectKey = m_containers.back() == 'd';
+        m_state = State::Value;
+    }
+}
+
+// --- Lazy cursor ---
+namespace Bencode
+{
+    namespace
+    {
+        // Returns the offset of the ':' ending the length prefix at `offset`
+        // and stores the string length in `length`.
+        size_t readStringHeader(std::string_view input, size_t offset, size_t &length)
+        {
+            const char *begin = input.data() + offset;
+            const char *end = input.data() + input.size();
+            const char *colon = static_cast<const char *>(std::memchr(begin, ':', end - begin));
+            if (colon == nullptr)
+            {
+                throw std::runtime_error("Invalid bencoded string: missing colon.");
+            }
+            auto result = std::from_chars(begin, colon, length);
+            if (begin == colon || result.ec != std::errc() || result.ptr != colon)
+            {
+                throw std::runtime_error("Invalid bencoded string: bad length.");
+            }
+            size_t colon_pos = static_cast<size_t>(colon - input.data());
+            if (length > input.size() - colon_pos - 1)
+            {
+                throw std::runtime_error("Invalid bencoded string: length exceeds buffer size.");
+            }
+            return colon_pos;
+        }
+
+        // Returns the offset just past the value starting at `offset`. Strings
+        // are jumped over in one step; only containers are walked.
+        size_t skipValue(std::string_view input, size_t offset)
+        {
+            size_t depth = 0;
+            do
+            {
+                if (offset >= input.size())
+                {
+                    throw std::runtime_error("Invalid bencode: unexpected end of input.");
+                }
+
+                char c = input[offset];
+                if (c == 'l' || c == 'd')
+                {
+                    depth++;
+                    offset++;
+                }
+                else if (c == 'e' && depth > 0)
+                {
+                    depth--;
+                    offset++;
+                }
+                else if (c == 'i')
+                {
+                    size_t end_pos = input.find('e', offset + 1);
+                    if (end_pos == std::string_view::npos)
+                    {
+                        throw std::runtime_error("Invalid bencoded integer: missing 'e'.");
+                    }
+                    offset = end_pos + 1;
+                }
+                else if (std::isdigit(static_cast<unsigned char>(c)))
+                {
+                    size_t length = 0;
+                    offset = readStringHeader(input, offset, length) + 1 + length;
+                }
+                else
+                {
+                    throw std::runtime_error("Unhandled bencoded value type.");
+                }
+            } while (depth > 0);
+            return offset;
+        }
+    }
+
+    Cursor::Cursor(std::string_view encoded_value) : Cursor(encoded_value, 0) {}
+
+    Cursor::Cursor(std::string_view encoded_value, size_t offset) : m_input(encoded_value), m_offset(offset) {}
+
+    Node::Type Cursor::type() const
+    {
+        if (m_offset >= m_input.size())
+        {
+            throw std::runtime_error("Invalid bencode: unexpected end of input.");
+        }
+
+        char c = m_input[m_offset];
+        if (c == 'i')
+            return Node::Type::Integer;
+        if (c == 'l')
+            return Node::Type::List;
+        if (c == 'd')
+            return Node::Type::Dict;
+        if (std::isdigit(static_cast<unsigned char>(c)))
+            return Node::Type::String;
+        throw std::runtime_error("Unhandled bencoded value type.");
+    }
+
+    long long Cursor::asInteger() const
+    {
+        if (type() != Node::Type::Integer)
+            throw std::runtime_error("Bencode node is not an integer.");
+
+        size_t end_pos = m_input.find('e', m_offset + 1);
+        if (end_pos == std::string_view::npos)
+        {
+            throw std::runtime_error("Invalid bencoded integer: missing 'e'.");
+        }
+
+        long long value = 0;
+        auto result = std::from_chars(m_input.data() + m_offset + 1, m_input.data() + end_pos, value);
+        if (result.ec != std::errc() || result.ptr != m_input.data() + end_pos)
+        {
+            throw std::runtime_error("Invalid bencoded integer.");
+        }
+        return value;
+    }
+
+    std::string_view Cursor::asString() const
+    {
+        if (type() != Node::Type::String)
+            throw std::runtime_error("Bencode node is not a string.");
+
+        size_t length = 0;
+        size_t colon_pos = readStringHeader(m_input, m_offset, length);
+        return m_input.substr(colon_pos + 1, length);
+    }
+
+    std::string_view Cursor::raw() const
+    {
+        return m_input.substr(m_offset, skipValue(m_input, m_offset) - m_offset);
+    }
+
+    std::optional<Cursor> Cursor::find(std::string_view key) const
+    {
+        if (type() != Node::Type::Dict)
+            throw std::runtime_error("Bencode node is not a dictionary.");
+
+        size_t offset = m_offset + 1; // Skip 'd'
+        while (offset < m_input.size() && m_input[offset] != 'e')
+        {
+            if (!std::isdigit(static_cast<unsigned char>(m_input[offset])))
+            {
+                throw std::runtime_error("Invalid bencoded dictionary: key is not a string.");
+            }
+
+            size_t length = 0;
+            size_t colon_pos = readStringHeader(m_input, offset, length);
+            size_t value_pos = colon_pos + 1 + length;
+            if (m_input.substr(colon_pos + 1, length) == key)
+            {
+                return Cursor(m_input, value_pos);
+            }
+            offset = skipValue(m_input, value_pos);
+        }
+        if (offset >= m_input.size())
+        {
+            throw std::runtime_error("Invalid bencoded dictionary: missing 'e'.");
         }
-        return os.str();
+        return std::nullopt;
     }
 }
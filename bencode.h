@@ -1,6 +1,14 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
 #include "lib/nlohmann/json.hpp"
 
 namespace Bencode
@@ -10,4 +18,287 @@ namespace Bencode
 
     // Declares the encoding function
     std::string json_to_bencode(const nlohmann::json &value);
-}
\ No newline at end of file
+
+    // Appends the encoding of `value` to `out` without intermediate strings.
+    void append_bencode(const nlohmann::json &value, std::string &out);
+
+    // Exact number of bytes the encoding of `value` takes, so a buffer can be
+    // sized once before encoding into it.
+    size_t encoded_size(const nlohmann::json &value);
+
+    namespace detail
+    {
+        template <typename Sink>
+        void encode_into(const nlohmann::json &value, Sink &sink)
+        {
+            char digits[24];
+            auto writeNumber = [&](auto number)
+            {
+                auto result = std::to_chars(digits, digits + sizeof(digits), number);
+                sink.write(digits, static_cast<size_t>(result.ptr - digits));
+            };
+            auto writeString = [&](const std::string &str)
+            {
+                writeNumber(str.size());
+                sink.put(':');
+                sink.write(str.data(), str.size());
+            };
+
+            if (value.is_object())
+            {
+                sink.put('d');
+                for (auto &el : value.items())
+                {
+                    writeString(el.key());
+                    encode_into(el.value(), sink);
+                }
+                sink.put('e');
+            }
+            else if (value.is_array())
+            {
+                sink.put('l');
+                for (const auto &item : value)
+                {
+                    encode_into(item, sink);
+                }
+                sink.put('e');
+            }
+            else if (value.is_number_unsigned())
+            {
+                sink.put('i');
+                writeNumber(value.get<unsigned long long>());
+                sink.put('e');
+            }
+            else if (value.is_number_integer())
+            {
+                sink.put('i');
+                writeNumber(value.get<long long>());
+                sink.put('e');
+            }
+            else if (value.is_string())
+            {
+                writeString(value.get_ref<const std::string &>());
+            }
+        }
+
+        template <typename OutputIt>
+        struct IteratorSink
+        {
+            OutputIt out;
+            void put(char c) { *out++ = c; }
+            void write(const char *data, size_t length) { out = std::copy(data, data + length, out); }
+        };
+    }
+
+    // Writes the encoding of `value` to an output iterator and returns the
+    // iterator past the last byte written.
+    template <typename OutputIt>
+    OutputIt encode_to(const nlohmann::json &value, OutputIt out)
+    {
+        detail::IteratorSink<OutputIt> sink{out};
+        detail::encode_into(value, sink);
+        return sink.out;
+    }
+
+    // --- Zero-copy document API ---
+
+    // Bump allocator that owns every node of a Document. Memory is handed out
+    // from a few growing blocks and released all at once with the arena.
+    class Arena
+    {
+    public:
+        Arena() = default;
+        Arena(const Arena &) = delete;
+        Arena &operator=(const Arena &) = delete;
+        Arena(Arena &&) = default;
+        Arena &operator=(Arena &&) = default;
+
+        void *allocate(size_t size, size_t alignment);
+
+        // Makes the next block at least `size` bytes, so a caller that knows
+        // its total up front gets away with a single allocation.
+        void reserve(size_t size) { m_nextBlockSize = std::max(m_nextBlockSize, size); }
+
+        template <typename T>
+        T *allocateArray(size_t count)
+        {
+            return static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+        }
+
+    private:
+        std::vector<std::unique_ptr<char[]>> m_blocks;
+        char *m_current = nullptr;
+        size_t m_remaining = 0;
+        size_t m_nextBlockSize = 4096;
+    };
+
+    // A decoded value. Strings point straight into the input buffer, so the
+    // buffer must outlive the Document that owns the node.
+    class Node
+    {
+    public:
+        enum class Type : uint8_t
+        {
+            Integer,
+            String,
+            List,
+            Dict
+        };
+
+        Type type() const { return m_type; }
+        bool isInteger() const { return m_type == Type::Integer; }
+        bool isString() const { return m_type == Type::String; }
+        bool isList() const { return m_type == Type::List; }
+        bool isDict() const { return m_type == Type::Dict; }
+
+        long long asInteger() const;
+        std::string_view asString() const;
+
+        // Number of elements of a list or entries of a dictionary.
+        size_t size() const;
+
+        // List element access.
+        const Node &operator[](size_t index) const;
+
+        // Dictionary entry access, in input order.
+        std::string_view keyAt(size_t index) const;
+        const Node &valueAt(size_t index) const;
+
+        // Returns the value stored under `key`, or nullptr if the dictionary has no such key.
+        const Node *find(std::string_view key) const;
+
+        // The exact encoded bytes of this value in the input buffer. Hashing this
+        // span gives the same result as the original file, key order included.
+        std::string_view raw() const { return std::string_view(m_raw, m_rawSize); }
+
+    private:
+        friend class DocumentBuilder;
+
+        Type m_type = Type::Integer;
+        size_t m_size = 0; // string length, list length or dict entry count
+        union
+        {
+            long long m_integer = 0;
+            const char *m_string;
+            const Node *m_children; // dicts store key/value node pairs
+        };
+        const char *m_raw = nullptr;
+        size_t m_rawSize = 0;
+    };
+
+    // Result of parse_document: the root node together with the arena that owns it.
+    class Document
+    {
+    public:
+        const Node &root() const { return *m_root; }
+
+    private:
+        friend class DocumentBuilder;
+
+        Arena m_arena;
+        const Node *m_root = nullptr;
+    };
+
+    // Decodes `encoded_value` in a single pass without copying any string data.
+    // Library-only: the client reads torrents through Cursor, which touches
+    // far fewer bytes, so neither this nor build_structural_index runs in it.
+    Document parse_document(std::string_view encoded_value);
+
+    // Lazy, non-owning view of one value inside a bencoded buffer. Nothing is
+    // decoded until asked for, and find() steps over unrelated values using
+    // their length prefixes instead of materializing them. Only the parts that
+    // are actually visited get validated.
+    class Cursor
+    {
+    public:
+        // Points at the value starting at the beginning of `encoded_value`.
+        explicit Cursor(std::string_view encoded_value);
+
+        Node::Type type() const;
+        long long asInteger() const;
+        std::string_view asString() const;
+
+        // The exact encoded bytes of this value.
+        std::string_view raw() const;
+
+        // Looks up `key` in a dictionary, or returns nullopt if it is absent.
+        std::optional<Cursor> find(std::string_view key) const;
+
+    private:
+        Cursor(std::string_view encoded_value, size_t offset);
+
+        std::string_view m_input;
+        size_t m_offset = 0;
+    };
+
+    // Offsets of every structural byte of a bencoded buffer: the 'd', 'l', 'i'
+    // and 'e' tokens plus the ':' that ends each string length prefix. Bytes
+    // inside string payloads never appear, so a decoder can walk this list
+    // instead of scanning the input byte by byte.
+    struct StructuralIndex
+    {
+        std::vector<uint32_t> offsets;
+    };
+
+    // Classifies the input 64 bytes at a time with SSE2/AVX2 (scalar elsewhere)
+    // and jumps over string payloads using their length prefixes. Nothing is
+    // validated here: the index just ends at the first ':' whose length
+    // prefix is malformed or runs past the input, and the consumer checks
+    // structure and reports errors in input order.
+    StructuralIndex build_structural_index(std::string_view encoded_value);
+
+    // --- Streaming (event) API ---
+
+    // Receives events from a StreamDecoder. Byte strings may be delivered in
+    // several fragments as input arrives; `remaining` is 0 on the last one.
+    class EventHandler
+    {
+    public:
+        virtual ~EventHandler() = default;
+        virtual void beginDict() {}
+        virtual void beginList() {}
+        virtual void end() {}
+        virtual void key(std::string_view) {}
+        virtual void integer(long long) {}
+        virtual void bytes(std::string_view, size_t) {}
+    };
+
+    // Push-based decoder that accepts input in arbitrary chunks and reports
+    // what it finds to an EventHandler. Only dictionary keys and number digits
+    // are buffered, so memory stays bounded regardless of the input size.
+    class StreamDecoder
+    {
+    public:
+        explicit StreamDecoder(EventHandler &handler);
+
+        // Consumes the next chunk of input. Throws on malformed bencode.
+        void feed(const char *data, size_t length);
+
+        // Throws if the input ended before a complete value was decoded.
+        void finish() const;
+
+        // True once a complete top-level value has been decoded.
+        bool done() const { return m_state == State::Done; }
+
+    private:
+        enum class State
+        {
+            Value,
+            StringLength,
+            StringData,
+            Integer,
+            Done
+        };
+
+        void beginValue(char c);
+        void endValue();
+
+        EventHandler &m_handler;
+        State m_state = State::Value;
+        std::vector<char> m_containers; // 'l' or 'd' for each open container
+        bool m_expectKey = false;
+        bool m_readingKey = false;
+        std::string m_token; // digits of a length/integer, or a key being read
+        size_t m_remaining = 0;
+    };
+}
@@ -0,0 +1,201 @@
+#include "bencode.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define BENCODE_X86 1
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Stage 1 of the document parser, in the spirit of simdjson: classify input
+// bytes in 64-byte blocks into a bitmask of candidate structural characters,
+// then walk the set bits, dropping those that fall inside string payloads.
+namespace
+{
+    const size_t BLOCK_SIZE = 64;
+
+    inline size_t countTrailingZeros(uint64_t mask)
+    {
+#ifdef _MSC_VER
+        unsigned long bit;
+        _BitScanForward64(&bit, mask);
+        return bit;
+#else
+        return static_cast<size_t>(__builtin_ctzll(mask));
+#endif
+    }
+
+    inline bool isCandidate(char c)
+    {
+        return c == 'd' || c == 'l' || c == 'i' || c == 'e' || c == ':';
+    }
+
+    uint64_t classifyScalar(const char *block)
+    {
+        uint64_t mask = 0;
+        for (size_t i = 0; i < BLOCK_SIZE; ++i)
+        {
+            if (isCandidate(block[i]))
+                mask |= uint64_t(1) << i;
+        }
+        return mask;
+    }
+
+#ifdef BENCODE_X86
+    uint64_t classifySse2(const char *block)
+    {
+        const __m128i d = _mm_set1_epi8('d');
+        const __m128i l = _mm_set1_epi8('l');
+        const __m128i i = _mm_set1_epi8('i');
+        const __m128i e = _mm_set1_epi8('e');
+        const __m128i colon = _mm_set1_epi8(':');
+
+        uint64_t mask = 0;
+        for (size_t offset = 0; offset < BLOCK_SIZE; offset += 16)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + offset));
+            __m128i hits = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, d), _mm_cmpeq_epi8(v, l)),
+                _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, i), _mm_cmpeq_epi8(v, e)), _mm_cmpeq_epi8(v, colon)));
+            mask |= uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(hits))) << offset;
+        }
+        return mask;
+    }
+
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((target("avx2")))
+#endif
+    uint64_t classifyAvx2(const char *block)
+    {
+        const __m256i d = _mm256_set1_epi8('d');
+        const __m256i l = _mm256_set1_epi8('l');
+        const __m256i i = _mm256_set1_epi8('i');
+        const __m256i e = _mm256_set1_epi8('e');
+        const __m256i colon = _mm256_set1_epi8(':');
+
+        uint64_t mask = 0;
+        for (size_t offset = 0; offset < BLOCK_SIZE; offset += 32)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + offset));
+            __m256i hits = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, d), _mm256_cmpeq_epi8(v, l)),
+                _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, i), _mm256_cmpeq_epi8(v, e)), _mm256_cmpeq_epi8(v, colon)));
+            mask |= uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(hits))) << offset;
+        }
+        return mask;
+    }
+
+    bool cpuHasAvx2()
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_cpu_supports("avx2");
+#elif defined(__AVX2__)
+        return true;
+#else
+        return false;
+#endif
+    }
+#endif
+
+    using ClassifyFn = uint64_t (*)(const char *);
+
+    ClassifyFn selectClassifier()
+    {
+#ifdef BENCODE_X86
+        if (cpuHasAvx2())
+            return classifyAvx2;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        return classifySse2;
+#endif
+#endif
+        return classifyScalar;
+    }
+}
+
+namespace Bencode
+{
+    StructuralIndex build_structural_index(std::string_view encoded_value)
+    {
+        static const ClassifyFn classify = selectClassifier();
+
+        const char *data = encoded_value.data();
+        size_t size = encoded_value.size();
+        if (size > std::numeric_limits<uint32_t>::max())
+        {
+            throw std::runtime_error("Bencode input too large to index.");
+        }
+
+        StructuralIndex index;
+        std::vector<uint32_t> &offsets = index.offsets;
+        size_t count = 0;
+        size_t cursor = 0; // first byte not yet known to be part of a token
+        size_t base = 0;
+        bool stopped = false; // hit a ':' whose length prefix is not valid
+        while (base < size && !stopped)
+        {
+            uint64_t mask;
+            if (size - base >= BLOCK_SIZE)
+            {
+                mask = classify(data + base);
+            }
+            else
+            {
+                // Zero padding never matches, so the tail goes through the same path.
+                char tail[BLOCK_SIZE] = {};
+                std::memcpy(tail, data + base, size - base);
+                mask = classify(tail);
+            }
+            if (cursor > base)
+                mask &= ~uint64_t(0) << (cursor - base); // Rest of the previous payload
+
+            // A block adds at most 64 entries, so grow once per block and
+            // write without per-entry capacity checks.
+            if (offsets.size() < count + BLOCK_SIZE)
+                offsets.resize(std::max(offsets.size() * 2, count + BLOCK_SIZE));
+            uint32_t *out = offsets.data() + count;
+
+            while (mask != 0)
+            {
+                size_t position = base + countTrailingZeros(mask);
+                mask &= mask - 1;
+                *out++ = static_cast<uint32_t>(position);
+                if (data[position] != ':')
+                {
+                    cursor = position + 1;
+                    continue;
+                }
+
+                // Where a payload would end is unknown past a bad prefix, so
+                // the index ends at its ':'. The consumer reports the error
+                // once it gets there, after any error earlier in the input.
+                size_t length = 0;
+                auto result = std::from_chars(data + cursor, data + position, length);
+                if (cursor == position || result.ec != std::errc() || result.ptr != data + position ||
+                    length > size - position - 1)
+                {
+                    stopped = true;
+                    break;
+                }
+                cursor = position + 1 + length;
+                if (cursor >= base + BLOCK_SIZE)
+                    break;
+                mask &= ~uint64_t(0) << (cursor - base); // Drop bytes inside the payload
+            }
+            count = static_cast<size_t>(out - offsets.data());
+
+            // Large payloads are skipped without classifying the blocks they cover.
+            base += BLOCK_SIZE;
+            if (cursor > base)
+                base = cursor - cursor % BLOCK_SIZE;
+        }
+        offsets.resize(count);
+        return index;
+    }
+}
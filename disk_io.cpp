@@ -0,0 +1,237 @@
+#include "disk_io.h"
+#include "storage.h"
+
+#include <algorithm> // For std::max, std::min
+#include <iostream>
+#include <iterator>
+
+using Clock = std::chrono::steady_clock;
+
+DiskIO::DiskIO(Storage &storage, const Options &options)
+    : m_storage(storage), m_options(options)
+{
+    size_t threadCount = std::max<size_t>(m_options.threads, 1);
+    m_workers.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; ++i)
+    {
+        m_workers.emplace_back(&DiskIO::workerLoop, this);
+    }
+}
+
+DiskIO::~DiskIO()
+{
+    try
+    {
+        flush();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: Failed to write cached data: " << e.what() << std::endl;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_workAvailable.notify_all();
+    for (std::thread &worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+void DiskIO::write(uint64_t offset, std::vector<uint8_t> data)
+{
+    if (data.empty())
+        return;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_progress.wait(lock, [this]
+                    { return m_error || m_cachedBytes + m_queuedBytes < 2 * m_options.cacheSize; });
+    rethrowLocked();
+
+    insertLocked(offset, std::move(data));
+    if (m_cachedBytes >= m_options.cacheSize)
+    {
+        scheduleAllLocked();
+    }
+    m_workAvailable.notify_all();
+}
+
+void DiskIO::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_flushRequested = true;
+    m_workAvailable.notify_all();
+    m_progress.wait(lock, [this]
+                    { return m_cache.empty() && m_queue.empty() && m_writing == 0; });
+    m_flushRequested = false;
+    rethrowLocked();
+    lock.unlock();
+
+    // Every write issued before this point is complete, so one sync covers them all.
+    m_storage.sync();
+
+    lock.lock();
+    m_unsyncedBytes = 0;
+}
+
+uint64_t DiskIO::writesIssued() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_writesIssued;
+}
+
+void DiskIO::insertLocked(uint64_t offset, std::vector<uint8_t> data)
+{
+    m_cachedBytes += data.size();
+    auto next = m_cache.lower_bound(offset);
+
+    // Extend the run that ends where this data starts, or start a new one.
+    auto run = m_cache.end();
+    if (next != m_cache.begin())
+    {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second.data.size() == offset)
+        {
+            previous->second.data.insert(previous->second.data.end(), data.begin(), data.end());
+            run = previous;
+        }
+    }
+    if (run == m_cache.end())
+    {
+        run = m_cache.emplace_hint(next, offset, Run{std::move(data), Clock::now()});
+    }
+
+    // The run may now also touch the one after it.
+    auto following = std::next(run);
+    if (following != m_cache.end() && run->first + run->second.data.size() == following->first)
+    {
+        std::vector<uint8_t> &merged = run->second.data;
+        merged.insert(merged.end(), following->second.data.begin(), following->second.data.end());
+        run->second.since = std::min(run->second.since, following->second.since);
+        m_cache.erase(following);
+    }
+
+    if (run->second.data.size() >= m_options.writeSize)
+    {
+        scheduleLocked(run);
+    }
+}
+
+void DiskIO::scheduleLocked(std::map<uint64_t, Run>::iterator run)
+{
+    size_t size = run->second.data.size();
+    m_cachedBytes -= size;
+    m_queuedBytes += size;
+    m_queue.emplace_back(run->first, std::move(run->second.data));
+    m_cache.erase(run);
+}
+
+void DiskIO::scheduleAllLocked()
+{
+    while (!m_cache.empty())
+    {
+        scheduleLocked(m_cache.begin());
+    }
+}
+
+void DiskIO::rethrowLocked()
+{
+    if (m_error)
+    {
+        std::rethrow_exception(m_error);
+    }
+}
+
+void DiskIO::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        if (m_flushRequested || m_stopping)
+        {
+            scheduleAllLocked();
+        }
+
+        // Runs that have waited long enough are written even if they are short.
+        Clock::time_point now = Clock::now();
+        Clock::time_point nextDeadline = Clock::time_point::max();
+        for (auto run = m_cache.begin(); run != m_cache.end();)
+        {
+            Clock::time_point deadline = run->second.since + m_options.maxDelay;
+            if (deadline <= now)
+            {
+                scheduleLocked(run++);
+                continue;
+            }
+            nextDeadline = std::min(nextDeadline, deadline);
+            ++run;
+        }
+
+        if (m_queue.empty())
+        {
+            if (m_stopping)
+                return;
+            if (nextDeadline == Clock::time_point::max())
+                m_workAvailable.wait(lock);
+            else
+                m_workAvailable.wait_until(lock, nextDeadline);
+            continue;
+        }
+
+        // Take an even share of what is queued, so storage that can keep
+        // several writes in flight gets them in one batch while the other
+        // writers still have work.
+        size_t share = (m_queue.size() + m_workers.size() - 1) / m_workers.size();
+        std::vector<std::pair<uint64_t, std::vector<uint8_t>>> batch;
+        std::vector<Storage::WriteRequest> requests;
+        size_t batchBytes = 0;
+        for (size_t i = 0; i < share; ++i)
+        {
+            batch.push_back(std::move(m_queue.front()));
+            m_queue.pop_front();
+            requests.push_back({batch.back().first, batch.back().second.data(), batch.back().second.size()});
+            batchBytes += batch.back().second.size();
+        }
+        m_writing += batch.size();
+        lock.unlock();
+
+        std::exception_ptr error;
+        try
+        {
+            m_storage.writeBatch(requests);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        lock.lock();
+        m_writing -= batch.size();
+        m_queuedBytes -= batchBytes;
+        m_writesIssued += batch.size();
+        m_unsyncedBytes += batchBytes;
+        if (error && !m_error)
+            m_error = error;
+
+        bool syncNow = !error && m_unsyncedBytes >= m_options.syncBytes;
+        if (syncNow)
+        {
+            m_unsyncedBytes = 0;
+            lock.unlock();
+            try
+            {
+                m_storage.sync();
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            lock.lock();
+            if (error && !m_error)
+                m_error = error;
+        }
+        m_progress.notify_all();
+    }
+}
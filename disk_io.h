@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef> // For size_t
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Storage;
+
+// Storage subsystem between the download loop and the data file. Verified
+// pieces are accepted into a write-back cache that merges adjacent pieces,
+// and dedicated threads turn the merged runs into large sequential writes.
+// fsync is batched rather than issued per write. Keeps slow or random-access
+// disks from stalling the threads that talk to peers.
+class DiskIO
+{
+public:
+    struct Options
+    {
+        size_t threads = 2;                          // writer threads
+        size_t writeSize = 8 << 20;                  // a merged run this long is written out right away
+        size_t cacheSize = 64 << 20;                 // cached bytes that trigger writing everything
+        std::chrono::milliseconds maxDelay{1000};    // nothing stays cached longer than this
+        uint64_t syncBytes = uint64_t(256) << 20;    // bytes written between two fsyncs
+    };
+
+    DiskIO(Storage &storage, const Options &options);
+
+    // Writes and syncs everything still cached, then joins the threads.
+    // Errors at this point are reported on stderr; call flush() first to see them.
+    ~DiskIO();
+
+    DiskIO(const DiskIO &) = delete;
+    DiskIO &operator=(const DiskIO &) = delete;
+
+    // Queues `data` for writing at `offset`. Ranges must not overlap.
+    // Blocks while twice cacheSize bytes are waiting to be written, and
+    // rethrows the first error a writer thread ran into.
+    void write(uint64_t offset, std::vector<uint8_t> data);
+
+    // Writes out everything cached and syncs the file. Returns once it is all
+    // on stable storage; throws if any write or sync failed.
+    void flush();
+
+    // Number of write calls issued to the file so far, after merging.
+    uint64_t writesIssued() const;
+
+private:
+    struct Run
+    {
+        std::vector<uint8_t> data;
+        std::chrono::steady_clock::time_point since; // when its oldest byte was cached
+    };
+
+    void insertLocked(uint64_t offset, std::vector<uint8_t> data);
+    void scheduleLocked(std::map<uint64_t, Run>::iterator run);
+    void scheduleAllLocked();
+    void workerLoop();
+    void rethrowLocked();
+
+    Storage &m_storage;
+    Options m_options;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_workAvailable;
+    std::condition_variable m_progress;
+    std::map<uint64_t, Run> m_cache;                           // merged runs by offset
+    std::deque<std::pair<uint64_t, std::vector<uint8_t>>> m_queue; // runs handed to the writers
+    size_t m_cachedBytes = 0;
+    size_t m_queuedBytes = 0; // in m_queue or being written
+    size_t m_writing = 0;
+    uint64_t m_unsyncedBytes = 0;
+    uint64_t m_writesIssued = 0;
+    bool m_flushRequested = false;
+    bool m_stopping = false;
+    std::exception_ptr m_error;
+
+    std::vector<std::thread> m_workers;
+};
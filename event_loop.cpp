@@ -0,0 +1,745 @@
+#include "event_loop.h"
+
+#include <algorithm> // For std::max, std::remove
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h> // For socklen_t
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring> // For strerror
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define closesocket close
+#endif
+
+#ifdef __linux__
+#include "uring.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+    const int MAX_EVENTS_PER_ROUND = 256;
+
+#ifdef __linux__
+    // Ring mode: submission queue slots, and the receive buffers provided to
+    // the kernel. A receive takes a buffer only once data has arrived and
+    // hands it back as soon as its handler returns, so the buffers bound the
+    // receives completing in one round, not the sockets.
+    const unsigned RING_ENTRIES = 256;
+    const unsigned RECEIVE_BUFFERS = 64; // a power of two
+    const unsigned RECEIVE_BUFFER_SIZE = 64 * 1024;
+    const uint16_t RECEIVE_BUFFER_GROUP = 0;
+    // user_data of ring entries that are not operations.
+    const uint64_t CANCEL_ID = 0;
+    const uint64_t WAKE_ID = 1;
+    // How long the destructor waits for cancelled operations to finish.
+    const auto RING_STOP_TIMEOUT = std::chrono::seconds(1);
+#endif
+
+    int timeoutMillis(std::chrono::milliseconds timeout)
+    {
+        return static_cast<int>(std::max<std::chrono::milliseconds::rep>(timeout.count(), 0));
+    }
+
+#ifdef __linux__
+    // Also used for IORING_OP_POLL_ADD: poll and epoll bits have the same
+    // values on Linux.
+    uint32_t toEpoll(unsigned events)
+    {
+        uint32_t result = 0;
+        if (events & EventLoop::Readable)
+            result |= EPOLLIN;
+        if (events & EventLoop::Writable)
+            result |= EPOLLOUT;
+        return result; // EPOLLERR and EPOLLHUP are always reported
+    }
+
+    unsigned fromEpoll(uint32_t events)
+    {
+        unsigned result = 0;
+        if (events & EPOLLIN)
+            result |= EventLoop::Readable;
+        if (events & EPOLLOUT)
+            result |= EventLoop::Writable;
+        if (events & (EPOLLERR | EPOLLHUP))
+            result |= EventLoop::Error;
+        return result;
+    }
+#else
+    short toPoll(unsigned events)
+    {
+        short result = 0;
+        if (events & EventLoop::Readable)
+            result |= POLLIN;
+        if (events & EventLoop::Writable)
+            result |= POLLOUT;
+        return result;
+    }
+
+    unsigned fromPoll(short events)
+    {
+        unsigned result = 0;
+        if (events & POLLIN)
+            result |= EventLoop::Readable;
+        if (events & POLLOUT)
+            result |= EventLoop::Writable;
+        if (events & (POLLERR | POLLHUP | POLLNVAL))
+            result |= EventLoop::Error;
+        return result;
+    }
+#endif
+}
+
+#ifdef __linux__
+
+// One receive, send or poll handed to the ring. Kept until its last
+// completion arrives, even once cancelled, since the kernel may still be
+// using `data` until then.
+struct EventLoop::Operation
+{
+    enum class Kind
+    {
+        Poll,
+        Receive,
+        Send
+    };
+
+    Operation(Kind kind, int fd) : kind(kind), fd(fd) {}
+
+    Kind kind;
+    int fd;
+    unsigned events = 0;      // Poll
+    Completion onComplete;    // Poll, Send
+    ReceiveHandler onReceive; // Receive
+    std::vector<uint8_t> data; // Send
+    size_t sent = 0;           // Send: bytes of data already sent
+    bool cancelled = false;
+};
+
+struct EventLoop::Ring
+{
+    Uring uring;
+    io_uring_buf_ring *bufferRing = nullptr;
+    size_t bufferRingSize = 0;
+    uint16_t bufferTail = 0;
+    std::vector<uint8_t> buffers; // RECEIVE_BUFFERS of RECEIVE_BUFFER_SIZE
+    uint64_t wakeCount = 0;       // the eventfd is read into this
+    bool wakeArmed = false;
+
+    uint64_t nextId = WAKE_ID + 1;
+    std::unordered_map<uint64_t, std::unique_ptr<Operation>> operations;
+    std::unordered_map<int, std::vector<uint64_t>> operationsByFd;
+
+    ~Ring()
+    {
+        uring.destroy(); // Also unregisters the buffer ring
+        if (bufferRing != nullptr)
+            munmap(bufferRing, bufferRingSize);
+    }
+
+    // A submission entry for `userData`, making room if the queue is full.
+    io_uring_sqe &nextSqe(uint64_t userData)
+    {
+        io_uring_sqe *sqe = uring.nextSqe();
+        if (sqe == nullptr)
+        {
+            uring.enter(0);
+            sqe = uring.nextSqe();
+        }
+        if (sqe == nullptr)
+            throw std::runtime_error("io_uring submission queue is full.");
+        sqe->user_data = userData;
+        return *sqe;
+    }
+};
+
+EventLoop::EventLoop(Backend backend) : m_backend(backend)
+{
+    if (backend == Backend::Ring)
+    {
+        // Blocking, so the wake-up read always waits in the kernel: some
+        // kernels complete reads of O_NONBLOCK files with -EAGAIN instead.
+        m_wakeFd = eventfd(0, EFD_CLOEXEC);
+        if (m_wakeFd == -1)
+            throw std::runtime_error(std::string("Failed to create eventfd: ") + std::strerror(errno));
+        try
+        {
+            setupRing();
+        }
+        catch (...)
+        {
+            m_ring.reset();
+            ::close(m_wakeFd);
+            throw;
+        }
+        return;
+    }
+
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr; // marks the wake-up descriptor
+    if (m_epollFd == -1 || m_wakeFd == -1 || epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &event) == -1)
+    {
+        std::string reason = std::strerror(errno);
+        if (m_wakeFd != -1)
+            ::close(m_wakeFd);
+        if (m_epollFd != -1)
+            ::close(m_epollFd);
+        throw std::runtime_error("Failed to create epoll instance: " + reason);
+    }
+}
+
+EventLoop::~EventLoop()
+{
+    if (m_ring)
+        stopRing();
+    ::close(m_wakeFd);
+    if (m_epollFd != -1)
+        ::close(m_epollFd);
+}
+
+bool EventLoop::ringAvailable()
+{
+    static const bool supported = []
+    {
+        try
+        {
+            EventLoop loop(Backend::Ring);
+            return true;
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+    }();
+    return supported;
+}
+
+void EventLoop::setupRing()
+{
+    m_ring = std::make_unique<Ring>();
+    Ring &ring = *m_ring;
+    if (!ring.uring.setup(RING_ENTRIES))
+        throw std::runtime_error(std::string("Failed to set up io_uring: ") + std::strerror(errno));
+    // runOnce() waits with a timeout through IORING_ENTER_EXT_ARG (5.11).
+    if ((ring.uring.features() & IORING_FEAT_EXT_ARG) == 0)
+        throw std::runtime_error("io_uring cannot wait with a timeout on this kernel.");
+
+    // The buffer ring is shared with the kernel: it takes buffers from the
+    // head, and provideBuffer() puts them back at the tail.
+    ring.bufferRingSize = RECEIVE_BUFFERS * sizeof(io_uring_buf);
+    void *bufferRing = mmap(nullptr, ring.bufferRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufferRing == MAP_FAILED)
+        throw std::runtime_error(std::string("Failed to map the receive buffer ring: ") + std::strerror(errno));
+    ring.bufferRing = static_cast<io_uring_buf_ring *>(bufferRing);
+
+    io_uring_buf_reg registration{};
+    registration.ring_addr = reinterpret_cast<uint64_t>(bufferRing);
+    registration.ring_entries = RECEIVE_BUFFERS;
+    registration.bgid = RECEIVE_BUFFER_GROUP;
+    int result = ring.uring.registerResource(IORING_REGISTER_PBUF_RING, &registration, 1);
+    if (result < 0)
+        throw std::runtime_error(std::string("Failed to provide receive buffers to io_uring: ") + std::strerror(-result));
+
+    ring.buffers.resize(static_cast<size_t>(RECEIVE_BUFFERS) * RECEIVE_BUFFER_SIZE);
+    for (unsigned id = 0; id < RECEIVE_BUFFERS; ++id)
+    {
+        provideBuffer(static_cast<uint16_t>(id));
+    }
+    armWake();
+}
+
+void EventLoop::stopRing()
+{
+    // The kernel may still be reading send data or writing the wake-up
+    // counter, so cancel everything and wait for it before freeing them.
+    Ring &ring = *m_ring;
+    for (auto &[id, operation] : ring.operations)
+    {
+        operation->cancelled = true;
+    }
+    io_uring_sqe &sqe = ring.nextSqe(CANCEL_ID);
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.cancel_flags = IORING_ASYNC_CANCEL_ANY;
+
+    auto deadline = std::chrono::steady_clock::now() + RING_STOP_TIMEOUT;
+    while ((ring.wakeArmed || !ring.operations.empty()) && std::chrono::steady_clock::now() < deadline)
+    {
+        std::chrono::nanoseconds wait = RING_STOP_TIMEOUT / 10;
+        ring.uring.enter(1, &wait);
+        io_uring_cqe cqe;
+        while (ring.uring.popCompletion(cqe))
+        {
+            if (cqe.user_data == WAKE_ID)
+                ring.wakeArmed = false;
+            else
+                ring.operations.erase(cqe.user_data);
+        }
+    }
+    m_ring.reset();
+}
+
+void EventLoop::wake()
+{
+    if (m_wakePending.exchange(true, std::memory_order_acq_rel))
+        return;
+    uint64_t one = 1;
+    ssize_t written = ::write(m_wakeFd, &one, sizeof(one));
+    (void)written; // Only fails if the counter is already non-zero, which wakes the loop too
+}
+
+void EventLoop::drainWake()
+{
+    // Cleared before the caller looks at whatever it was woken for, so a
+    // wake() that comes in afterwards is never lost.
+    m_wakePending.store(false, std::memory_order_release);
+    uint64_t count;
+    ssize_t received = ::read(m_wakeFd, &count, sizeof(count));
+    (void)received;
+}
+
+void EventLoop::armWake()
+{
+    // In ring mode the eventfd is read through the ring, so wake() ends the
+    // wait like any other completion.
+    io_uring_sqe &sqe = m_ring->nextSqe(WAKE_ID);
+    sqe.opcode = IORING_OP_READ;
+    sqe.fd = m_wakeFd;
+    sqe.addr = reinterpret_cast<uint64_t>(&m_ring->wakeCount);
+    sqe.len = sizeof(m_ring->wakeCount);
+    m_ring->wakeArmed = true;
+}
+
+void EventLoop::provideBuffer(uint16_t id)
+{
+    Ring &ring = *m_ring;
+    // Not bufferRing->bufs: compiled as C++, the header's flexible array
+    // follows an empty struct that takes a byte, so it starts one entry late.
+    io_uring_buf &buffer = reinterpret_cast<io_uring_buf *>(ring.bufferRing)[ring.bufferTail & (RECEIVE_BUFFERS - 1)];
+    buffer.addr = reinterpret_cast<uint64_t>(ring.buffers.data() + static_cast<size_t>(id) * RECEIVE_BUFFER_SIZE);
+    buffer.len = RECEIVE_BUFFER_SIZE;
+    buffer.bid = id;
+    ++ring.bufferTail;
+    __atomic_store_n(&ring.bufferRing->tail, ring.bufferTail, __ATOMIC_RELEASE);
+}
+
+void EventLoop::add(int fd, unsigned events, Handler handler)
+{
+    if (m_ring)
+        throw std::logic_error("EventLoop::add is not available in ring mode.");
+    auto entry = std::make_unique<Entry>(Entry{fd, events, std::move(handler)});
+    epoll_event event{};
+    event.events = toEpoll(events);
+    event.data.ptr = entry.get();
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+        throw std::runtime_error(std::string("Failed to watch socket: ") + std::strerror(errno));
+    }
+    m_entries[fd] = std::move(entry);
+}
+
+void EventLoop::modify(int fd, unsigned events)
+{
+    if (m_ring)
+        throw std::logic_error("EventLoop::modify is not available in ring mode.");
+    auto found = m_entries.find(fd);
+    if (found == m_entries.end() || found->second->events == events)
+        return;
+    epoll_event event{};
+    event.events = toEpoll(events);
+    event.data.ptr = found->second.get();
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_MOD, fd, &event) == -1)
+    {
+        throw std::runtime_error(std::string("Failed to update socket events: ") + std::strerror(errno));
+    }
+    found->second->events = events;
+}
+
+void EventLoop::pollOnce(int fd, unsigned events, Completion handler)
+{
+    auto operation = std::make_unique<Operation>(Operation::Kind::Poll, fd);
+    operation->events = events;
+    operation->onComplete = std::move(handler);
+    startOperation(std::move(operation));
+}
+
+void EventLoop::receive(int fd, ReceiveHandler handler)
+{
+    auto operation = std::make_unique<Operation>(Operation::Kind::Receive, fd);
+    operation->onReceive = std::move(handler);
+    startOperation(std::move(operation));
+}
+
+void EventLoop::send(int fd, std::vector<uint8_t> data, Completion handler)
+{
+    auto operation = std::make_unique<Operation>(Operation::Kind::Send, fd);
+    operation->data = std::move(data);
+    operation->onComplete = std::move(handler);
+    startOperation(std::move(operation));
+}
+
+void EventLoop::startOperation(std::unique_ptr<Operation> operation)
+{
+    if (!m_ring)
+        throw std::logic_error("EventLoop operations are only available in ring mode.");
+    uint64_t id = m_ring->nextId++;
+    m_ring->operationsByFd[operation->fd].push_back(id);
+    submitOperation(id, *operation);
+    m_ring->operations.emplace(id, std::move(operation));
+}
+
+void EventLoop::submitOperation(uint64_t id, const Operation &operation)
+{
+    // Queued only; runOnce() hands everything queued to the kernel at once.
+    io_uring_sqe &sqe = m_ring->nextSqe(id);
+    sqe.fd = operation.fd;
+    switch (operation.kind)
+    {
+    case Operation::Kind::Poll:
+        sqe.opcode = IORING_OP_POLL_ADD;
+        sqe.poll32_events = toEpoll(operation.events);
+        break;
+    case Operation::Kind::Receive:
+        sqe.opcode = IORING_OP_RECV;
+        sqe.flags = IOSQE_BUFFER_SELECT;
+        sqe.buf_group = RECEIVE_BUFFER_GROUP;
+        sqe.len = RECEIVE_BUFFER_SIZE;
+        break;
+    case Operation::Kind::Send:
+        sqe.opcode = IORING_OP_SEND;
+        sqe.addr = reinterpret_cast<uint64_t>(operation.data.data() + operation.sent);
+        sqe.len = static_cast<uint32_t>(operation.data.size() - operation.sent);
+        sqe.msg_flags = MSG_NOSIGNAL;
+        break;
+    }
+}
+
+void EventLoop::remove(int fd)
+{
+    if (m_ring)
+    {
+        auto found = m_ring->operationsByFd.find(fd);
+        if (found == m_ring->operationsByFd.end())
+            return;
+        for (uint64_t id : found->second)
+        {
+            auto operation = m_ring->operations.find(id);
+            if (operation == m_ring->operations.end())
+                continue;
+            operation->second->cancelled = true;
+            io_uring_sqe &sqe = m_ring->nextSqe(CANCEL_ID);
+            sqe.opcode = IORING_OP_ASYNC_CANCEL;
+            sqe.addr = id;
+        }
+        m_ring->operationsByFd.erase(found);
+        // The caller closes the socket next. Submitting now makes the
+        // operations take their own reference to it first; left queued,
+        // they would look the descriptor up later and could find another
+        // socket that reused it.
+        m_ring->uring.enter(0);
+        return;
+    }
+
+    auto found = m_entries.find(fd);
+    if (found == m_entries.end())
+        return;
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    found->second->removed = true;
+    m_removed.push_back(std::move(found->second));
+    m_entries.erase(found);
+}
+
+size_t EventLoop::runOnce(std::chrono::milliseconds timeout)
+{
+    if (m_ring)
+    {
+        // One call submits everything queued since the last round and waits.
+        std::chrono::nanoseconds wait = std::max(timeout, std::chrono::milliseconds(0));
+        int result = m_ring->uring.enter(1, &wait);
+        if (result < 0 && result != -ETIME && result != -EINTR && result != -EAGAIN && result != -EBUSY)
+            throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(-result));
+
+        size_t handled = 0;
+        io_uring_cqe cqe;
+        while (m_ring->uring.popCompletion(cqe))
+        {
+            handled += complete(cqe.user_data, cqe.res, cqe.flags);
+        }
+        return handled;
+    }
+
+    epoll_event events[MAX_EVENTS_PER_ROUND];
+    int ready = epoll_wait(m_epollFd, events, MAX_EVENTS_PER_ROUND, timeoutMillis(timeout));
+    if (ready == -1)
+    {
+        if (errno == EINTR)
+            return 0;
+        throw std::runtime_error(std::string("epoll_wait failed: ") + std::strerror(errno));
+    }
+
+    for (int i = 0; i < ready; ++i)
+    {
+        if (events[i].data.ptr == nullptr)
+            drainWake();
+        else
+            dispatch(static_cast<Entry *>(events[i].data.ptr), fromEpoll(events[i].events));
+    }
+    m_removed.clear();
+    return static_cast<size_t>(ready);
+}
+
+
+size_t EventLoop::complete(uint64_t id, int result, uint32_t flags)
+{
+    Ring &ring = *m_ring;
+    if (id == CANCEL_ID)
+        return 0;
+    if (id == WAKE_ID)
+    {
+        m_wakePending.store(false, std::memory_order_release); // see drainWake()
+        armWake();
+        return 0;
+    }
+
+    auto found = ring.operations.find(id);
+    if (found == ring.operations.end())
+        return 0;
+    Operation &operation = *found->second;
+    bool hasBuffer = (flags & IORING_CQE_F_BUFFER) != 0;
+    uint16_t bufferId = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+
+    // Retried in place: no buffer was free, or the call was interrupted.
+    bool retry = result == -EINTR || result == -EAGAIN || (operation.kind == Operation::Kind::Receive && result == -ENOBUFS);
+    if (operation.kind == Operation::Kind::Send && result > 0)
+    {
+        operation.sent += static_cast<size_t>(result);
+        retry = operation.sent < operation.data.size();
+    }
+
+    size_t handled = 0;
+    if (operation.cancelled)
+    {
+        retry = false;
+    }
+    else if (retry)
+    {
+        submitOperation(id, operation);
+    }
+    else
+    {
+        switch (operation.kind)
+        {
+        case Operation::Kind::Poll:
+            operation.onComplete(result < 0 ? result : static_cast<int>(fromEpoll(static_cast<uint32_t>(result))));
+            break;
+        case Operation::Kind::Receive:
+            operation.onReceive(result, hasBuffer ? ring.buffers.data() + static_cast<size_t>(bufferId) * RECEIVE_BUFFER_SIZE
+                                                  : nullptr);
+            break;
+        case Operation::Kind::Send:
+            // A send that makes no progress would never finish.
+            operation.onComplete(result > 0 ? static_cast<int>(operation.sent) : result == 0 ? -EPIPE : result);
+            break;
+        }
+        handled = 1;
+    }
+
+    if (hasBuffer)
+        provideBuffer(bufferId);
+    if (!retry)
+    {
+        // The handler may have removed the socket, and a new one may have
+        // taken its descriptor, so look the id up rather than the fd.
+        auto byFd = ring.operationsByFd.find(operation.fd);
+        if (byFd != ring.operationsByFd.end())
+        {
+            std::vector<uint64_t> &ids = byFd->second;
+            ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+            if (ids.empty())
+                ring.operationsByFd.erase(byFd);
+        }
+        ring.operations.erase(id);
+    }
+    return handled;
+}
+
+#else
+
+EventLoop::EventLoop(Backend backend) : m_backend(backend)
+{
+    if (backend == Backend::Ring)
+        throw std::runtime_error("io_uring is only available on Linux.");
+
+    // Without eventfd, a UDP socket that sends to itself is the portable way
+    // (Windows included) to make poll() return from another thread.
+    m_wakeSocket = static_cast<int>(socket(AF_INET, SOCK_DGRAM, 0));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    bool ok = m_wakeSocket >= 0 && bind(m_wakeSocket, (sockaddr *)&address, sizeof(address)) == 0 &&
+              getsockname(m_wakeSocket, (sockaddr *)&address, &length) == 0 &&
+              connect(m_wakeSocket, (sockaddr *)&address, sizeof(address)) == 0;
+#ifdef _WIN32
+    u_long enabled = 1;
+    ok = ok && ioctlsocket(m_wakeSocket, FIONBIO, &enabled) == 0;
+#else
+    ok = ok && fcntl(m_wakeSocket, F_SETFL, fcntl(m_wakeSocket, F_GETFL, 0) | O_NONBLOCK) != -1;
+#endif
+    if (!ok)
+    {
+        if (m_wakeSocket >= 0)
+            closesocket(m_wakeSocket);
+        throw std::runtime_error("Failed to create the event loop wake-up socket.");
+    }
+}
+
+EventLoop::~EventLoop()
+{
+    closesocket(m_wakeSocket);
+}
+
+bool EventLoop::ringAvailable()
+{
+    return false;
+}
+
+void EventLoop::wake()
+{
+    if (m_wakePending.exchange(true, std::memory_order_acq_rel))
+        return;
+    char byte = 0;
+    send(m_wakeSocket, &byte, 1, 0);
+}
+
+void EventLoop::drainWake()
+{
+    // Cleared before the caller looks at whatever it was woken for, so a
+    // wake() that comes in afterwards is never lost.
+    m_wakePending.store(false, std::memory_order_release);
+    char buffer[64];
+    while (recv(m_wakeSocket, buffer, sizeof(buffer), 0) > 0)
+    {
+    }
+}
+
+void EventLoop::add(int fd, unsigned events, Handler handler)
+{
+    m_entries[fd] = std::make_unique<Entry>(Entry{fd, events, std::move(handler)});
+}
+
+void EventLoop::modify(int fd, unsigned events)
+{
+    auto found = m_entries.find(fd);
+    if (found != m_entries.end())
+        found->second->events = events;
+}
+
+void EventLoop::pollOnce(int, unsigned, Completion)
+{
+    throw std::logic_error("EventLoop operations are only available in ring mode.");
+}
+
+void EventLoop::receive(int, ReceiveHandler)
+{
+    throw std::logic_error("EventLoop operations are only available in ring mode.");
+}
+
+void EventLoop::send(int, std::vector<uint8_t>, Completion)
+{
+    throw std::logic_error("EventLoop operations are only available in ring mode.");
+}
+
+void EventLoop::remove(int fd)
+{
+    auto found = m_entries.find(fd);
+    if (found == m_entries.end())
+        return;
+    found->second->removed = true;
+    m_removed.push_back(std::move(found->second));
+    m_entries.erase(found);
+}
+
+size_t EventLoop::runOnce(std::chrono::milliseconds timeout)
+{
+    // poll() has no registration, so the set is rebuilt every round. The
+    // wake-up socket goes first, without an entry.
+    std::vector<pollfd> fds;
+    std::vector<Entry *> entries;
+    fds.reserve(m_entries.size() + 1);
+    entries.reserve(m_entries.size() + 1);
+    pollfd wakeItem{};
+    wakeItem.fd = m_wakeSocket;
+    wakeItem.events = POLLIN;
+    fds.push_back(wakeItem);
+    entries.push_back(nullptr);
+    for (const auto &[fd, entry] : m_entries)
+    {
+        pollfd item{};
+        item.fd = fd;
+        item.events = toPoll(entry->events);
+        fds.push_back(item);
+        entries.push_back(entry.get());
+    }
+
+#ifdef _WIN32
+    int ready = WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), timeoutMillis(timeout));
+    if (ready == SOCKET_ERROR)
+        throw std::runtime_error("WSAPoll failed.");
+#else
+    int ready = poll(fds.data(), static_cast<nfds_t>(fds.size()), timeoutMillis(timeout));
+    if (ready == -1)
+    {
+        if (errno == EINTR)
+            return 0;
+        throw std::runtime_error(std::string("poll failed: ") + std::strerror(errno));
+    }
+#endif
+
+    size_t handled = 0;
+    for (size_t i = 0; i < fds.size() && handled < static_cast<size_t>(ready); ++i)
+    {
+        if (fds[i].revents == 0)
+            continue;
+        if (entries[i] == nullptr)
+            drainWake();
+        else
+            dispatch(entries[i], fromPoll(fds[i].revents));
+        ++handled;
+    }
+    m_removed.clear();
+    return handled;
+}
+
+#endif
+
+void EventLoop::dispatch(Entry *entry, unsigned events)
+{
+    // A handler earlier in this round may have removed the socket.
+    if (entry->removed)
+        return;
+    events &= entry->events | Error;
+    if (events != 0)
+        entry->handler(events);
+}
+
+EventLoop::Backend parseEventLoopBackend(const std::string &name)
+{
+    if (name == "poll")
+        return EventLoop::Backend::Readiness;
+    if (name == "uring")
+        return EventLoop::Backend::Ring;
+    throw std::runtime_error("Unknown network backend '" + name + "' (expected poll or uring).");
+}
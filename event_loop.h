@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef> // For size_t
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Drives non-blocking sockets from one thread, in one of two ways:
+//
+// - Readiness (the default): epoll on Linux, poll() (WSAPoll on Windows)
+//   elsewhere. Sockets are watched with add() and modify(), and their owner
+//   calls recv()/send() itself. Level-triggered, so a handler that leaves
+//   data unread is called again on the next round.
+// - Ring (Linux 5.19+, see ringAvailable()): the kernel does the I/O and
+//   the loop reports completions. Receives, sends and one-shot polls are
+//   queued as io_uring submission entries and go to the kernel together
+//   with the wait, one io_uring_enter per round however many sockets are
+//   busy. Receives land in buffers provided to the kernel up front, picked
+//   only once data has arrived, so idle sockets hold none. add() and
+//   modify() are not available in this mode.
+//
+// Not thread-safe: every call except wake() must come from the thread that
+// runs the loop.
+class EventLoop
+{
+public:
+    enum Events : unsigned
+    {
+        Readable = 1,
+        Writable = 2,
+        Error = 4 // error or hang-up; always reported, never needs asking for
+    };
+
+    enum class Backend
+    {
+        Readiness,
+        Ring
+    };
+
+    // Called with the Events that are ready on the socket.
+    using Handler = std::function<void(unsigned events)>;
+    // Called with the outcome of a ring operation: >= 0 on success,
+    // otherwise -errno.
+    using Completion = std::function<void(int result)>;
+    // Called with the number of bytes received at `data`, which is only
+    // valid during the call; 0 if the peer closed, otherwise -errno.
+    using ReceiveHandler = std::function<void(int result, const uint8_t *data)>;
+
+    // Throws if the backend cannot be set up.
+    explicit EventLoop(Backend backend = Backend::Readiness);
+    ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    // Whether this process can run the Ring backend: io_uring may be
+    // compiled out, disabled by sysctl or blocked by seccomp, and provided
+    // buffer rings need Linux 5.19.
+    static bool ringAvailable();
+    bool usesRing() const { return m_backend == Backend::Ring; }
+
+    // Readiness mode only. Starts watching `fd` for `events`. Throws on failure.
+    void add(int fd, unsigned events, Handler handler);
+
+    // Readiness mode only. Changes the events `fd` is watched for. Throws on failure.
+    void modify(int fd, unsigned events);
+
+    // Ring mode only. Each of these calls its handler once, from runOnce(),
+    // unless `fd` is removed first.
+    // Waits until `fd` is ready for `events`; the result is the Events that are.
+    void pollOnce(int fd, unsigned events, Completion handler);
+    // Receives once from `fd` into one of the provided buffers.
+    void receive(int fd, ReceiveHandler handler);
+    // Sends all of `data`, which the loop keeps until the kernel is done
+    // with it; the result is the number of bytes sent.
+    void send(int fd, std::vector<uint8_t> data, Completion handler);
+
+    // Stops watching `fd` and cancels its ring operations, whose handlers
+    // then never run. Must be called before the socket is closed. Safe from
+    // inside a handler, including the socket's own.
+    void remove(int fd);
+
+    // Waits up to `timeout` for at least one socket to become ready, or one
+    // ring operation to complete, and runs the handlers of all of them.
+    // Returns the number of handlers run.
+    size_t runOnce(std::chrono::milliseconds timeout);
+
+    // Makes the current or next runOnce() return promptly. Safe from any
+    // thread; calls made before the loop gets to run collapse into one.
+    void wake();
+
+    size_t size() const { return m_entries.size(); }
+
+private:
+    struct Entry
+    {
+        int fd;
+        unsigned events;
+        Handler handler;
+        bool removed = false;
+    };
+
+    void dispatch(Entry *entry, unsigned events);
+    void drainWake();
+#ifdef __linux__
+    struct Operation;
+    struct Ring;
+    void setupRing();
+    void stopRing();
+    void armWake();
+    void provideBuffer(uint16_t id);
+    void startOperation(std::unique_ptr<Operation> operation);
+    void submitOperation(uint64_t id, const Operation &operation);
+    size_t complete(uint64_t id, int result, uint32_t flags);
+#endif
+
+    std::unordered_map<int, std::unique_ptr<Entry>> m_entries;
+    // Entries removed during a round stay alive until it ends, since their
+    // handler may still be running or have events pending in the same batch.
+    std::vector<std::unique_ptr<Entry>> m_removed;
+    std::atomic<bool> m_wakePending{false};
+    Backend m_backend;
+#ifdef __linux__
+    int m_epollFd = -1; // readiness mode
+    int m_wakeFd = -1;  // eventfd
+    std::unique_ptr<Ring> m_ring; // ring mode
+#else
+    int m_wakeSocket = -1; // UDP socket connected to itself
+#endif
+};
+
+// Parses "poll" (Readiness) or "uring" (Ring). Throws on anything else.
+EventLoop::Backend parseEventLoopBackend(const std::string &name);
@@ -0,0 +1,29 @@
+#include "hash_verifier.h"
+#include "torrent_file.h"
+
+#include <stdexcept>
+#include <string_view>
+
+HashVerifier::HashVerifier(const TorrentFile &torrent) : m_torrent(torrent) {}
+
+void HashVerifier::submit(size_t pieceIndex, std::vector<uint8_t> data, const std::string &digest)
+{
+    if (pieceIndex >= m_torrent.getNumPieces())
+    {
+        throw std::out_of_range("Piece index out of range.");
+    }
+
+    std::string_view expectedHash = m_torrent.getPieceHashes().substr(pieceIndex * 20, 20);
+    m_completions.push_back({pieceIndex, std::move(data), digest == expectedHash});
+}
+
+std::optional<HashVerifier::Completion> HashVerifier::poll()
+{
+    if (m_completions.empty())
+    {
+        return std::nullopt;
+    }
+    Completion completion = std::move(m_completions.front());
+    m_completions.pop_front();
+    return completion;
+}
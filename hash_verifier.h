@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef> // For size_t
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <vector>
+
+class TorrentFile;
+
+// Checks downloaded pieces against the torrent's SHA-1 hashes. Pieces come
+// in already hashed: PeerConnection feeds each block to the piece's SHA-1 as
+// it arrives, on the reactor thread that owns the connection, so checking is
+// a compare. Results are queued as completions, so the caller acts on them
+// outside the Swarm callback that delivered the piece. Not thread-safe.
+class HashVerifier
+{
+public:
+    struct Completion
+    {
+        size_t pieceIndex;
+        std::vector<uint8_t> data;
+        bool valid;
+    };
+
+    explicit HashVerifier(const TorrentFile &torrent);
+
+    HashVerifier(const HashVerifier &) = delete;
+    HashVerifier &operator=(const HashVerifier &) = delete;
+
+    // Checks a complete piece whose raw 20-byte SHA-1 is `digest`.
+    void submit(size_t pieceIndex, std::vector<uint8_t> data, const std::string &digest);
+
+    // Returns the next checked piece, or nullopt if there is none.
+    std::optional<Completion> poll();
+
+private:
+    const TorrentFile &m_torrent;
+    std::deque<Completion> m_completions;
+};
@@ -23,12 +23,29 @@
 #define SHA1_HPP
 
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <numeric>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SHA1_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SHA1_TARGET(features)
+#else
+#include <cpuid.h>
+#define SHA1_TARGET(features) __attribute__((target(features)))
+#endif
+#endif
 
 
 class SHA1
@@ -37,9 +54,22 @@ public:
     SHA1();
     void update(const std::string &s);
     void update(std::istream &is);
+    /* Whole blocks are hashed in place; only a partial block is buffered */
+    void update(const void *data, size_t length);
     std::string final();
+    std::string final_bytes();
     static std::string from_file(const std::string &filename);
 
+    /* Name of the block function picked for this CPU, e.g. "sha-ni" */
+    static const char *backend();
+
+    /* Raw 20-byte digests of independent messages, hashed several at a time in
+     * SIMD lanes. Batches of equal-length messages (torrent pieces) are fastest. */
+    static std::vector<std::string> hash_many(const std::vector<std::string_view> &messages);
+
+    /* Number of messages hash_many() advances together on this CPU */
+    static size_t lanes();
+
 private:
     uint32_t digest[5];
     std::string buffer;
@@ -228,15 +258,576 @@ inline static void transform(uint32_t digest[], uint32_t block[BLOCK_INTS], uint
 }
 
 
-inline static void buffer_to_block(const std::string &buffer, uint32_t block[BLOCK_INTS])
+/*
+ * Block functions. All of them consume `blocks` consecutive 64-byte blocks
+ * straight from `data`; the best one for the running CPU is picked once at
+ * first use (SHA extensions when the CPU has them, scalar otherwise).
+ */
+
+typedef void (*sha1_compress_fn)(uint32_t digest[], const uint8_t *data, size_t blocks);
+
+
+inline static void bytes_to_block(const uint8_t *bytes, uint32_t block[BLOCK_INTS])
 {
-    /* Convert the std::string (byte buffer) to a uint32_t array (MSB) */
     for (size_t i = 0; i < BLOCK_INTS; i++)
     {
-        block[i] = (buffer[4*i+3] & 0xff)
-                   | (buffer[4*i+2] & 0xff)<<8
-                   | (buffer[4*i+1] & 0xff)<<16
-                   | (buffer[4*i+0] & 0xff)<<24;
+        block[i] = (uint32_t)bytes[4*i+3]
+                   | (uint32_t)bytes[4*i+2]<<8
+                   | (uint32_t)bytes[4*i+1]<<16
+                   | (uint32_t)bytes[4*i+0]<<24;
+    }
+}
+
+
+inline static void compress_scalar(uint32_t digest[], const uint8_t *data, size_t blocks)
+{
+    uint64_t unused = 0;
+    for (; blocks > 0; blocks--, data += BLOCK_BYTES)
+    {
+        uint32_t block[BLOCK_INTS];
+        bytes_to_block(data, block);
+        transform(digest, block, unused);
+    }
+}
+
+
+#ifdef SHA1_X86
+
+/*
+ * Intel SHA extensions. Four rounds per sha1rnds4; the message schedule is
+ * kept in four registers that rotate roles every group of four rounds.
+ */
+
+template <size_t G>
+SHA1_TARGET("sha,sse4.1,ssse3")
+inline static void shani_rounds(__m128i &abcd, __m128i e[2], __m128i msg[4])
+{
+    const int F = (int)(G / 5);
+    __m128i &cur = msg[G & 3];
+    if (G & 1)
+    {
+        e[1] = _mm_sha1nexte_epu32(e[1], cur);
+        e[0] = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e[1], F);
+    }
+    else
+    {
+        e[0] = _mm_sha1nexte_epu32(e[0], cur);
+        e[1] = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e[0], F);
+    }
+    if (G >= 3 && G <= 18)
+        msg[(G+1) & 3] = _mm_sha1msg2_epu32(msg[(G+1) & 3], cur);
+    if (G <= 16)
+        msg[(G+3) & 3] = _mm_sha1msg1_epu32(msg[(G+3) & 3], cur);
+    if (G >= 2 && G <= 17)
+        msg[(G+2) & 3] = _mm_xor_si128(msg[(G+2) & 3], cur);
+}
+
+
+SHA1_TARGET("sha,sse4.1,ssse3")
+inline static void compress_shani(uint32_t digest[], const uint8_t *data, size_t blocks)
+{
+    const __m128i byte_swap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)digest), 0x1B);
+    __m128i e0 = _mm_set_epi32((int)digest[4], 0, 0, 0);
+
+    for (; blocks > 0; blocks--, data += BLOCK_BYTES)
+    {
+        __m128i abcd_save = abcd;
+        __m128i e_save = e0;
+        __m128i msg[4];
+        __m128i e[2];
+        for (size_t i = 0; i < 4; i++)
+        {
+            msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16*i)), byte_swap);
+        }
+
+        /* Rounds 0-3 add E directly; every later group uses sha1nexte */
+        e[0] = _mm_add_epi32(e0, msg[0]);
+        e[1] = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e[0], 0);
+
+        shani_rounds<1>(abcd, e, msg);
+        shani_rounds<2>(abcd, e, msg);
+        shani_rounds<3>(abcd, e, msg);
+        shani_rounds<4>(abcd, e, msg);
+        shani_rounds<5>(abcd, e, msg);
+        shani_rounds<6>(abcd, e, msg);
+        shani_rounds<7>(abcd, e, msg);
+        shani_rounds<8>(abcd, e, msg);
+        shani_rounds<9>(abcd, e, msg);
+        shani_rounds<10>(abcd, e, msg);
+        shani_rounds<11>(abcd, e, msg);
+        shani_rounds<12>(abcd, e, msg);
+        shani_rounds<13>(abcd, e, msg);
+        shani_rounds<14>(abcd, e, msg);
+        shani_rounds<15>(abcd, e, msg);
+        shani_rounds<16>(abcd, e, msg);
+        shani_rounds<17>(abcd, e, msg);
+        shani_rounds<18>(abcd, e, msg);
+        shani_rounds<19>(abcd, e, msg);
+
+        /* The last group ran with e[1]; e[0] holds A of round 76 */
+        e0 = _mm_sha1nexte_epu32(e[0], e_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i *)digest, _mm_shuffle_epi32(abcd, 0x1B));
+    digest[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+
+inline static bool cpu_has_sha_extensions()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuidex(info, 7, 0);
+    bool sha = (info[1] & (1 << 29)) != 0;
+    __cpuid(info, 1);
+    return sha && (info[2] & (1 << 19)) && (info[2] & (1 << 9));
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return false;
+    bool sha = (ebx & (1u << 29)) != 0;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+    return sha && (ecx & (1u << 19)) && (ecx & (1u << 9));
+#endif
+}
+
+#endif /* SHA1_X86 */
+
+
+struct sha1_backend
+{
+    sha1_compress_fn compress;
+    const char *name;
+};
+
+
+inline static sha1_backend select_backend()
+{
+#ifdef SHA1_X86
+    if (cpu_has_sha_extensions())
+        return {compress_shani, "sha-ni"};
+#endif
+    return {compress_scalar, "scalar"};
+}
+
+
+inline static const sha1_backend &active_backend()
+{
+    static const sha1_backend backend = select_backend();
+    return backend;
+}
+
+
+/*
+ * Multi-buffer hashing: several independent messages advance together, one
+ * per 32-bit lane of a vector register, in the style of the ISA-L multi-buffer
+ * hashes. Lanes never interact, so the rounds are the plain FIPS 180 ones
+ * applied lane-wise; the gain comes from doing 4, 8 or 16 blocks per
+ * instruction instead of one.
+ */
+
+static const size_t SHA1_MAX_LANES = 16;
+
+
+/* Lane-wise state: word i of lane l lives at state[i*lanes + l] */
+typedef void (*sha1_lanes_fn)(uint32_t state[], const uint8_t *const data[], size_t blocks);
+
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SHA1_FLATTEN __attribute__((flatten))
+#else
+#define SHA1_FLATTEN
+#endif
+
+
+#ifdef SHA1_X86
+
+/*
+ * Vector primitives for each width. The kernel below is written once against
+ * these and inlined into a per-width entry point compiled for that ISA.
+ */
+
+struct sha1_vec_sse2
+{
+    typedef __m128i vec;
+    static const size_t LANES = 4;
+
+    SHA1_TARGET("sse2") static vec load(const uint32_t *p) { return _mm_load_si128((const __m128i *)p); }
+    SHA1_TARGET("sse2") static void store(uint32_t *p, vec v) { _mm_store_si128((__m128i *)p, v); }
+    SHA1_TARGET("sse2") static vec set1(uint32_t x) { return _mm_set1_epi32((int)x); }
+    SHA1_TARGET("sse2") static vec add(vec a, vec b) { return _mm_add_epi32(a, b); }
+    SHA1_TARGET("sse2") static vec xor4(vec a, vec b, vec c, vec d) { return _mm_xor_si128(_mm_xor_si128(a, b), _mm_xor_si128(c, d)); }
+    template <int BITS>
+    SHA1_TARGET("sse2") static vec rol(vec x) { return _mm_or_si128(_mm_slli_epi32(x, BITS), _mm_srli_epi32(x, 32 - BITS)); }
+    SHA1_TARGET("sse2") static vec ch(vec b, vec c, vec d) { return _mm_xor_si128(_mm_and_si128(b, _mm_xor_si128(c, d)), d); }
+    SHA1_TARGET("sse2") static vec parity(vec b, vec c, vec d) { return _mm_xor_si128(_mm_xor_si128(b, c), d); }
+    SHA1_TARGET("sse2") static vec maj(vec b, vec c, vec d) { return _mm_or_si128(_mm_and_si128(_mm_or_si128(b, c), d), _mm_and_si128(b, c)); }
+};
+
+
+struct sha1_vec_avx2
+{
+    typedef __m256i vec;
+    static const size_t LANES = 8;
+
+    SHA1_TARGET("avx2") static vec load(const uint32_t *p) { return _mm256_load_si256((const __m256i *)p); }
+    SHA1_TARGET("avx2") static void store(uint32_t *p, vec v) { _mm256_store_si256((__m256i *)p, v); }
+    SHA1_TARGET("avx2") static vec set1(uint32_t x) { return _mm256_set1_epi32((int)x); }
+    SHA1_TARGET("avx2") static vec add(vec a, vec b) { return _mm256_add_epi32(a, b); }
+    SHA1_TARGET("avx2") static vec xor4(vec a, vec b, vec c, vec d) { return _mm256_xor_si256(_mm256_xor_si256(a, b), _mm256_xor_si256(c, d)); }
+    template <int BITS>
+    SHA1_TARGET("avx2") static vec rol(vec x) { return _mm256_or_si256(_mm256_slli_epi32(x, BITS), _mm256_srli_epi32(x, 32 - BITS)); }
+    SHA1_TARGET("avx2") static vec ch(vec b, vec c, vec d) { return _mm256_xor_si256(_mm256_and_si256(b, _mm256_xor_si256(c, d)), d); }
+    SHA1_TARGET("avx2") static vec parity(vec b, vec c, vec d) { return _mm256_xor_si256(_mm256_xor_si256(b, c), d); }
+    SHA1_TARGET("avx2") static vec maj(vec b, vec c, vec d) { return _mm256_or_si256(_mm256_and_si256(_mm256_or_si256(b, c), d), _mm256_and_si256(b, c)); }
+};
+
+
+/* AVX-512 has native rotates and does each boolean function in one ternlog */
+struct sha1_vec_avx512
+{
+    typedef __m512i vec;
+    static const size_t LANES = 16;
+
+    SHA1_TARGET("avx512f") static vec load(const uint32_t *p) { return _mm512_load_si512((const void *)p); }
+    SHA1_TARGET("avx512f") static void store(uint32_t *p, vec v) { _mm512_store_si512((void *)p, v); }
+    SHA1_TARGET("avx512f") static vec set1(uint32_t x) { return _mm512_set1_epi32((int)x); }
+    SHA1_TARGET("avx512f") static vec add(vec a, vec b) { return _mm512_add_epi32(a, b); }
+    SHA1_TARGET("avx512f") static vec xor4(vec a, vec b, vec c, vec d) { return _mm512_ternarylogic_epi32(_mm512_xor_si512(a, b), c, d, 0x96); }
+    template <int BITS>
+    SHA1_TARGET("avx512f") static vec rol(vec x) { return _mm512_maskz_rol_epi32(0xffff, x, BITS); }
+    SHA1_TARGET("avx512f") static vec ch(vec b, vec c, vec d) { return _mm512_ternarylogic_epi32(b, c, d, 0xca); }
+    SHA1_TARGET("avx512f") static vec parity(vec b, vec c, vec d) { return _mm512_ternarylogic_epi32(b, c, d, 0x96); }
+    SHA1_TARGET("avx512f") static vec maj(vec b, vec c, vec d) { return _mm512_ternarylogic_epi32(b, c, d, 0xe8); }
+};
+
+
+/*
+ * The kernel is compiled without any ISA of its own and only ever flattened
+ * into the entry points below, so the vector ABI notes GCC raises for it
+ * never apply.
+ */
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+template <typename V, int F>
+inline static void lanes_round(const typename V::vec &v, typename V::vec &w, const typename V::vec &x, const typename V::vec &y, typename V::vec &z, const typename V::vec &wk)
+{
+    typename V::vec f = F == 0 ? V::ch(w, x, y) : F == 1 ? V::parity(w, x, y) : V::maj(w, x, y);
+    z = V::add(V::add(z, V::template rol<5>(v)), V::add(f, wk));
+    w = V::template rol<30>(w);
+}
+
+
+/* Next schedule word for round t, kept in a ring of the last sixteen */
+template <typename V>
+inline static const typename V::vec &lanes_word(typename V::vec w[BLOCK_INTS], const size_t t)
+{
+    if (t >= BLOCK_INTS)
+    {
+        w[t&15] = V::template rol<1>(V::xor4(w[(t+13)&15], w[(t+8)&15], w[(t+2)&15], w[t&15]));
+    }
+    return w[t&15];
+}
+
+
+template <typename V, int F>
+inline static void lanes_rounds20(typename V::vec s[5], typename V::vec w[BLOCK_INTS], const size_t first, const uint32_t k)
+{
+    const typename V::vec kv = V::set1(k);
+    typename V::vec &a = s[0], &b = s[1], &c = s[2], &d = s[3], &e = s[4];
+    for (size_t t = first; t < first + 20; t += 5)
+    {
+        lanes_round<V, F>(a, b, c, d, e, V::add(lanes_word<V>(w, t), kv));
+        lanes_round<V, F>(e, a, b, c, d, V::add(lanes_word<V>(w, t+1), kv));
+        lanes_round<V, F>(d, e, a, b, c, V::add(lanes_word<V>(w, t+2), kv));
+        lanes_round<V, F>(c, d, e, a, b, V::add(lanes_word<V>(w, t+3), kv));
+        lanes_round<V, F>(b, c, d, e, a, V::add(lanes_word<V>(w, t+4), kv));
+    }
+}
+
+
+template <typename V>
+inline static void compress_lanes(uint32_t state[], const uint8_t *const data[], size_t blocks)
+{
+    const size_t L = V::LANES;
+    typename V::vec s[5];
+    for (size_t i = 0; i < 5; i++)
+    {
+        s[i] = V::load(&state[i*L]);
+    }
+
+    for (size_t n = 0; n < blocks; n++)
+    {
+        /* Transpose the big-endian input words so word i of every lane is adjacent */
+        alignas(64) uint32_t words[BLOCK_INTS * L];
+        for (size_t lane = 0; lane < L; lane++)
+        {
+            uint32_t block[BLOCK_INTS];
+            bytes_to_block(data[lane] + n*BLOCK_BYTES, block);
+            for (size_t i = 0; i < BLOCK_INTS; i++)
+            {
+                words[i*L + lane] = block[i];
+            }
+        }
+        typename V::vec w[BLOCK_INTS];
+        for (size_t i = 0; i < BLOCK_INTS; i++)
+        {
+            w[i] = V::load(&words[i*L]);
+        }
+
+        typename V::vec saved[5] = {s[0], s[1], s[2], s[3], s[4]};
+        lanes_rounds20<V, 0>(s, w, 0, 0x5a827999);
+        lanes_rounds20<V, 1>(s, w, 20, 0x6ed9eba1);
+        lanes_rounds20<V, 2>(s, w, 40, 0x8f1bbcdc);
+        lanes_rounds20<V, 1>(s, w, 60, 0xca62c1d6);
+        for (size_t i = 0; i < 5; i++)
+        {
+            s[i] = V::add(s[i], saved[i]);
+        }
+    }
+
+    for (size_t i = 0; i < 5; i++)
+    {
+        V::store(&state[i*L], s[i]);
+    }
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+
+SHA1_TARGET("sse2") SHA1_FLATTEN
+inline static void compress_lanes_sse2(uint32_t state[], const uint8_t *const data[], size_t blocks)
+{
+    compress_lanes<sha1_vec_sse2>(state, data, blocks);
+}
+
+
+SHA1_TARGET("avx2") SHA1_FLATTEN
+inline static void compress_lanes_avx2(uint32_t state[], const uint8_t *const data[], size_t blocks)
+{
+    compress_lanes<sha1_vec_avx2>(state, data, blocks);
+}
+
+
+SHA1_TARGET("avx512f") SHA1_FLATTEN
+inline static void compress_lanes_avx512(uint32_t state[], const uint8_t *const data[], size_t blocks)
+{
+    compress_lanes<sha1_vec_avx512>(state, data, blocks);
+}
+
+
+/* AVX needs OS support for saving the wider registers, not just the CPUID bit */
+inline static size_t cpu_vector_lanes()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    if (!osxsave)
+        return sse2 ? 4 : 0;
+    unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    if ((xcr0 & 0xe6) == 0xe6 && (info[1] & (1 << 16)))
+        return 16;
+    if ((xcr0 & 0x6) == 0x6 && (info[1] & (1 << 5)))
+        return 8;
+    return sse2 ? 4 : 0;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return 16;
+    if (__builtin_cpu_supports("avx2"))
+        return 8;
+    if (__builtin_cpu_supports("sse2"))
+        return 4;
+    return 0;
+#endif
+}
+
+#endif /* SHA1_X86 */
+
+
+struct sha1_lanes_backend
+{
+    sha1_lanes_fn compress;
+    size_t lanes;
+};
+
+
+/*
+ * SHA extensions hash one message about as fast as eight AVX2 lanes, so with
+ * them only AVX-512 is worth batching for; without them any width beats the
+ * scalar rounds.
+ */
+
+inline static sha1_lanes_backend select_lanes_backend()
+{
+#ifdef SHA1_X86
+    size_t lanes = cpu_vector_lanes();
+    if (lanes < 16 && cpu_has_sha_extensions())
+        return {nullptr, 1};
+    switch (lanes)
+    {
+    case 16:
+        return {compress_lanes_avx512, 16};
+    case 8:
+        return {compress_lanes_avx2, 8};
+    case 4:
+        return {compress_lanes_sse2, 4};
+    }
+#endif
+    return {nullptr, 1};
+}
+
+
+inline static const sha1_lanes_backend &active_lanes_backend()
+{
+    static const sha1_lanes_backend backend = select_lanes_backend();
+    return backend;
+}
+
+
+/*
+ * Appends the 0x80 marker, zeros and the bit length after the last
+ * `tail_len` bytes of a `total_len` byte message. Returns the number of
+ * blocks written to `out` (one or two).
+ */
+
+inline static size_t pad_tail(uint8_t out[2*BLOCK_BYTES], const uint8_t *tail, size_t tail_len, uint64_t total_len)
+{
+    size_t blocks = tail_len + 9 <= BLOCK_BYTES ? 1 : 2;
+    std::memset(out, 0, blocks*BLOCK_BYTES);
+    std::memcpy(out, tail, tail_len);
+    out[tail_len] = 0x80;
+    uint64_t total_bits = total_len * 8;
+    for (size_t i = 0; i < 8; i++)
+    {
+        out[blocks*BLOCK_BYTES - 1 - i] = (uint8_t)(total_bits >> (8*i));
+    }
+    return blocks;
+}
+
+
+inline static std::string digest_to_bytes(const uint32_t digest[5])
+{
+    std::string result(20, '\0');
+    for (size_t i = 0; i < 5; i++)
+    {
+        result[4*i+0] = static_cast<char>(digest[i] >> 24);
+        result[4*i+1] = static_cast<char>(digest[i] >> 16);
+        result[4*i+2] = static_cast<char>(digest[i] >> 8);
+        result[4*i+3] = static_cast<char>(digest[i]);
+    }
+    return result;
+}
+
+
+/* Single-buffer digest with the regular block function */
+inline static std::string hash_one(std::string_view message)
+{
+    uint32_t digest[5];
+    std::string unused_buffer;
+    uint64_t unused_transforms;
+    reset(digest, unused_buffer, unused_transforms);
+
+    const uint8_t *data = (const uint8_t *)message.data();
+    size_t full = message.size() / BLOCK_BYTES;
+    active_backend().compress(digest, data, full);
+
+    uint8_t tail[2*BLOCK_BYTES];
+    size_t blocks = pad_tail(tail, data + full*BLOCK_BYTES, message.size() - full*BLOCK_BYTES, message.size());
+    active_backend().compress(digest, tail, blocks);
+    return digest_to_bytes(digest);
+}
+
+
+/*
+ * Hashes up to `backend.lanes` messages together. Blocks that every message
+ * has run in lockstep; messages of equal length (the common case: pieces of
+ * a torrent) also finish their padding blocks in lanes, anything else
+ * finishes one at a time.
+ */
+
+inline static void hash_lane_group(const sha1_lanes_backend &backend, const std::string_view *const messages[], size_t count, std::string *const digests[])
+{
+    const size_t L = backend.lanes;
+    alignas(64) uint32_t state[5 * SHA1_MAX_LANES];
+    const uint8_t *data[SHA1_MAX_LANES];
+    size_t common = SIZE_MAX;
+    for (size_t lane = 0; lane < L; lane++)
+    {
+        /* Idle lanes repeat the last message; their results are discarded */
+        const std::string_view &message = *messages[lane < count ? lane : count - 1];
+        data[lane] = (const uint8_t *)message.data();
+        common = std::min(common, message.size() / BLOCK_BYTES);
+
+        std::string unused_buffer;
+        uint64_t unused_transforms;
+        uint32_t digest[5];
+        reset(digest, unused_buffer, unused_transforms);
+        for (size_t i = 0; i < 5; i++)
+        {
+            state[i*L + lane] = digest[i];
+        }
+    }
+    backend.compress(state, data, common);
+
+    size_t rest = messages[0]->size() - common*BLOCK_BYTES;
+    bool same_tail = true;
+    for (size_t lane = 1; lane < count; lane++)
+    {
+        same_tail = same_tail && messages[lane]->size() == messages[0]->size();
+    }
+
+    if (same_tail && rest < BLOCK_BYTES)
+    {
+        alignas(64) uint8_t tails[SHA1_MAX_LANES][2*BLOCK_BYTES];
+        size_t blocks = 0;
+        for (size_t lane = 0; lane < L; lane++)
+        {
+            blocks = pad_tail(tails[lane], data[lane] + common*BLOCK_BYTES, rest, messages[0]->size());
+            data[lane] = tails[lane];
+        }
+        backend.compress(state, data, blocks);
+    }
+
+    for (size_t lane = 0; lane < count; lane++)
+    {
+        uint32_t digest[5];
+        for (size_t i = 0; i < 5; i++)
+        {
+            digest[i] = state[i*L + lane];
+        }
+        if (!(same_tail && rest < BLOCK_BYTES))
+        {
+            const std::string_view &message = *messages[lane];
+            const uint8_t *tail = data[lane] + common*BLOCK_BYTES;
+            size_t tail_len = message.size() - common*BLOCK_BYTES;
+            size_t full = tail_len / BLOCK_BYTES;
+            active_backend().compress(digest, tail, full);
+
+            uint8_t padded[2*BLOCK_BYTES];
+            size_t blocks = pad_tail(padded, tail + full*BLOCK_BYTES, tail_len - full*BLOCK_BYTES, message.size());
+            active_backend().compress(digest, padded, blocks);
+        }
+        *digests[lane] = digest_to_bytes(digest);
     }
 }
 
@@ -249,76 +840,149 @@ inline SHA1::SHA1()
 
 inline void SHA1::update(const std::string &s)
 {
-    std::istringstream is(s);
-    update(is);
+    update(s.data(), s.size());
 }
 
 
 inline void SHA1::update(std::istream &is)
 {
-    while (true)
+    char sbuf[64 * BLOCK_BYTES];
+    do
     {
-        char sbuf[BLOCK_BYTES];
-        is.read(sbuf, BLOCK_BYTES - buffer.size());
-        buffer.append(sbuf, (std::size_t)is.gcount());
+        is.read(sbuf, sizeof(sbuf));
+        update(sbuf, (std::size_t)is.gcount());
+    } while (is);
+}
+
+
+inline void SHA1::update(const void *data, size_t length)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+
+    /* Top up a partial block left by an earlier call first */
+    if (!buffer.empty())
+    {
+        size_t take = std::min(length, BLOCK_BYTES - buffer.size());
+        buffer.append((const char *)bytes, take);
+        bytes += take;
+        length -= take;
         if (buffer.size() != BLOCK_BYTES)
         {
             return;
         }
-        uint32_t block[BLOCK_INTS];
-        buffer_to_block(buffer, block);
-        transform(digest, block, transforms);
+        active_backend().compress(digest, (const uint8_t *)buffer.data(), 1);
+        transforms++;
         buffer.clear();
     }
+
+    size_t blocks = length / BLOCK_BYTES;
+    active_backend().compress(digest, bytes, blocks);
+    transforms += blocks;
+
+    buffer.append((const char *)bytes + blocks*BLOCK_BYTES, length - blocks*BLOCK_BYTES);
 }
 
 
 /*
- * Add padding and return the message digest.
+ * Add padding and return the message digest as a hex string.
  */
 
 inline std::string SHA1::final()
+{
+    std::string bytes = final_bytes();
+
+    /* Hex std::string */
+    std::ostringstream result;
+    for (unsigned char byte : bytes)
+    {
+        result << std::hex << std::setfill('0') << std::setw(2);
+        result << static_cast<int>(byte);
+    }
+    return result.str();
+}
+
+
+/*
+ * Add padding and return the raw 20-byte message digest.
+ */
+
+inline std::string SHA1::final_bytes()
 {
     /* Total number of hashed bits */
     uint64_t total_bits = (transforms*BLOCK_BYTES + buffer.size()) * 8;
 
-    /* Padding */
+    /* Padding: 0x80, zeros up to 8 bytes short of a block, then the length */
     buffer += (char)0x80;
-    size_t orig_size = buffer.size();
-    while (buffer.size() < BLOCK_BYTES)
+    while (buffer.size() % BLOCK_BYTES != BLOCK_BYTES - 8)
     {
         buffer += (char)0x00;
     }
+    for (int shift = 56; shift >= 0; shift -= 8)
+    {
+        buffer += (char)(total_bits >> shift);
+    }
+    active_backend().compress(digest, (const uint8_t *)buffer.data(), buffer.size() / BLOCK_BYTES);
+
+    /* Big-endian byte std::string */
+    std::string result = digest_to_bytes(digest);
 
-    uint32_t block[BLOCK_INTS];
-    buffer_to_block(buffer, block);
+    /* Reset for next run */
+    reset(digest, buffer, transforms);
+
+    return result;
+}
+
+
+inline const char *SHA1::backend()
+{
+    return active_backend().name;
+}
 
-    if (orig_size > BLOCK_BYTES - 8)
+
+inline std::vector<std::string> SHA1::hash_many(const std::vector<std::string_view> &messages)
+{
+    std::vector<std::string> digests(messages.size());
+    const sha1_lanes_backend &backend = active_lanes_backend();
+    if (backend.compress == nullptr)
     {
-        transform(digest, block, transforms);
-        for (size_t i = 0; i < BLOCK_INTS - 2; i++)
+        for (size_t i = 0; i < messages.size(); i++)
         {
-            block[i] = 0;
+            digests[i] = hash_one(messages[i]);
         }
+        return digests;
     }
 
-    /* Append total_bits, split this uint64_t into two uint32_t */
-    block[BLOCK_INTS - 1] = (uint32_t)total_bits;
-    block[BLOCK_INTS - 2] = (uint32_t)(total_bits >> 32);
-    transform(digest, block, transforms);
+    /* Neighbours in length order share a group, so equal lengths pad in lanes */
+    std::vector<size_t> order(messages.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return messages[a].size() < messages[b].size(); });
 
-    /* Hex std::string */
-    std::ostringstream result;
-    for (size_t i = 0; i < sizeof(digest) / sizeof(digest[0]); i++)
+    for (size_t i = 0; i < order.size(); i += backend.lanes)
     {
-        result << std::hex << std::setfill('0') << std::setw(8);
-        result << digest[i];
+        size_t count = std::min(backend.lanes, order.size() - i);
+        const std::string_view *group[SHA1_MAX_LANES];
+        std::string *results[SHA1_MAX_LANES];
+        for (size_t j = 0; j < count; j++)
+        {
+            group[j] = &messages[order[i+j]];
+            results[j] = &digests[order[i+j]];
+        }
+        if (count == 1)
+        {
+            *results[0] = hash_one(*group[0]);
+        }
+        else
+        {
+            hash_lane_group(backend, group, count, results);
+        }
     }
+    return digests;
+}
 
-    /* Reset for next run */
-    reset(digest, buffer, transforms);
 
-    return result.str();
+inline size_t SHA1::lanes()
+{
+    return active_lanes_backend().lanes;
 }
 
 
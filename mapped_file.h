@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstddef> // For size_t
+
+// Read-only memory mapping of a whole file. Views handed out by view() stay
+// valid for as long as the MappedFile (or whatever it was moved into) lives.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    // Maps the file at `filepath`, replacing any previous mapping. Returns true on success.
+    bool open(const std::string &filepath);
+
+    // Unmaps the file. Any views into it become dangling.
+    void close();
+
+    std::string_view view() const { return std::string_view(m_data, m_size); }
+    size_t size() const { return m_size; }
+
+private:
+    void swap(MappedFile &other) noexcept;
+
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    void *m_fileHandle = nullptr;
+    void *m_mappingHandle = nullptr;
+#endif
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+// Unbounded lock-free queue for many producer threads and one consumer
+// (Vyukov's linked-list design). push() is wait-free: one atomic exchange
+// and a store, so producers never wait on each other or on the consumer.
+// A pop() racing with a push() that has not finished may miss that item;
+// it becomes visible as soon as the push returns, so producers that wake the
+// consumer after pushing (see EventLoop::wake) never lose an item.
+template <typename T>
+class MpscQueue
+{
+public:
+    MpscQueue()
+    {
+        Node *stub = new Node();
+        m_head.store(stub, std::memory_order_relaxed);
+        m_tail = stub;
+    }
+
+    ~MpscQueue()
+    {
+        while (pop())
+        {
+        }
+        delete m_tail;
+    }
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    // Safe from any thread.
+    void push(T value)
+    {
+        Node *node = new Node();
+        node->value.emplace(std::move(value));
+        Node *previous = m_head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    // Consumer thread only. Returns nothing when the queue is (or appears) empty.
+    std::optional<T> pop()
+    {
+        Node *tail = m_tail;
+        Node *next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr)
+            return std::nullopt;
+        // `next` becomes the new stub; its value moves out to the caller.
+        std::optional<T> value = std::move(next->value);
+        next->value.reset();
+        m_tail = next;
+        delete tail;
+        return value;
+    }
+
+private:
+    struct Node
+    {
+        std::atomic<Node *> next{nullptr};
+        std::optional<T> value;
+    };
+
+    std::atomic<Node *> m_head; // most recently pushed node; producers swap it
+    Node *m_tail;               // stub before the oldest item; consumer only
+};
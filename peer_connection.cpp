@@ -1,13 +1,11 @@
 #include "peer_connection.h"
 #include "torrent_file.h"
-#include "lib/sha1.hpp" // For piece verification
+#include "event_loop.h"
 
 #include <iostream>
 #include <stdexcept>
 #include <cstring>   // For memcpy/memset
 #include <algorithm> // For std::min
-#include <deque>
-#include <iomanip> // For std::fixed, std::setprecision
 
 // --- FIX: Define NOMINMAX before including Windows headers ---
 // This prevents the Windows headers from defining min() and max() as macros,
@@ -20,6 +18,10 @@
 #else
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h> // For TCP_NODELAY
+#include <fcntl.h>
+#include <cerrno>
 #include <unistd.h>
 #define closesocket close
 #endif
@@ -27,6 +29,7 @@
 #ifdef _WIN32
 #include <BaseTsd.h>
 typedef SSIZE_T ssize_t;
+typedef int socklen_t;
 #else
 #include <unistd.h> // For ssize_t on Linux/macOS
 #endif
@@ -35,56 +38,86 @@ namespace
 {
     // --- Protocol Constants ---
     const size_t PIECE_BLOCK_SIZE = 16384; // 16 KB
+    const size_t HANDSHAKE_SIZE = 68;
     const uint8_t MSG_CHOKE = 0;
     const uint8_t MSG_UNCHOKE = 1;
     const uint8_t MSG_INTERESTED = 2;
+    const uint8_t MSG_HAVE = 4;
     const uint8_t MSG_BITFIELD = 5;
     const uint8_t MSG_REQUEST = 6;
     const uint8_t MSG_PIECE = 7;
+    const uint8_t MSG_CANCEL = 8;
+
+    // Block requests kept outstanding per peer: twice the measured
+    // bandwidth-delay product, within these bounds.
+    const size_t INITIAL_REQUESTS = 16;
+    const size_t MIN_REQUESTS = 4;
+    const size_t MAX_REQUESTS = 500;
+
+    // --- Timing ---
+    const auto CONNECT_TIMEOUT = std::chrono::seconds(10); // connect plus handshake
+    const auto REQUEST_TIMEOUT = std::chrono::seconds(30); // silence while blocks are owed
+    const auto KEEPALIVE_INTERVAL = std::chrono::seconds(90);
+    const auto QUEUE_DEPTH_INTERVAL = std::chrono::seconds(1);
+
+    // At most this much is read from one socket per event, so a fast peer
+    // cannot starve the others sharing the loop.
+    const size_t READ_CHUNK = 64 * 1024;
+    const size_t READ_BUDGET = 1024 * 1024;
+
+    int lastSocketError()
+    {
+#ifdef _WIN32
+        return WSAGetLastError();
+#else
+        return errno;
+#endif
+    }
 
-    // A helper struct for the download queue
-    struct BlockRequest
+    bool wouldBlock(int error)
     {
-        size_t pieceIndex;
-        size_t offset;
-        size_t length;
-    };
+#ifdef _WIN32
+        return error == WSAEWOULDBLOCK;
+#else
+        return error == EAGAIN || error == EWOULDBLOCK;
+#endif
+    }
 
-    // Safely sends a buffer over a socket, handling partial sends.
-    void sendAll(int sockfd, const char *data, size_t length)
+    bool setNonBlocking(int sockfd)
     {
-        size_t totalSent = 0;
-        while (totalSent < length)
-        {
-            ssize_t sent = send(sockfd, data + totalSent, length - totalSent, 0);
-            if (sent == -1)
-            {
-                throw std::runtime_error("Failed to send data to peer.");
-            }
-            totalSent += sent;
-        }
+#ifdef _WIN32
+        u_long enabled = 1;
+        return ioctlsocket(sockfd, FIONBIO, &enabled) == 0;
+#else
+        int flags = fcntl(sockfd, F_GETFL, 0);
+        return flags != -1 && fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) != -1;
+#endif
     }
 
-    // Safely receives data from a socket, handling partial receives.
-    void receiveAll(int sockfd, char *buffer, size_t length)
+    uint32_t readUint32(const uint8_t *bytes)
     {
-        size_t totalReceived = 0;
-        while (totalReceived < length)
-        {
-            ssize_t received = recv(sockfd, buffer + totalReceived, length - totalReceived, 0);
-            if (received <= 0)
-            {
-                throw std::runtime_error("Failed to receive data from peer (connection lost).");
-            }
-            totalReceived += received;
-        }
+        uint32_t value_n;
+        std::memcpy(&value_n, bytes, sizeof(value_n));
+        return ntohl(value_n);
+    }
+
+    void appendUint32(std::vector<uint8_t> &buffer, uint32_t value)
+    {
+        uint32_t value_n = htonl(value);
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value_n);
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(value_n));
     }
 }
 
 // --- Constructor / Destructor ---
 
-PeerConnection::PeerConnection(std::string ip, int port, const TorrentFile &torrent, std::string ourPeerId)
-    : m_ip(std::move(ip)), m_port(port), m_torrent(torrent), m_ourPeerId(std::move(ourPeerId)) {}
+PeerConnection::PeerConnection(std::string ip, int port, const TorrentFile &torrent, std::string ourPeerId,
+                               EventLoop &loop, Callbacks callbacks)
+    : m_ip(std::move(ip)), m_port(port), m_torrent(torrent), m_ourPeerId(std::move(ourPeerId)), m_loop(loop),
+      m_callbacks(std::move(callbacks)), m_maxRequests(INITIAL_REQUESTS)
+{
+    m_address = m_ip + ":" + std::to_string(m_port);
+}
 
 PeerConnection::~PeerConnection()
 {
@@ -95,200 +128,739 @@ void PeerConnection::disconnect()
 {
     if (m_sockfd != -1)
     {
+        m_loop.remove(m_sockfd);
         closesocket(m_sockfd);
         m_sockfd = -1;
     }
+    m_state = State::Closed;
 }
 
 // --- Public Methods ---
 
-bool PeerConnection::connectAndHandshake()
+bool PeerConnection::start()
 {
-    try
-    {
-        // 1. Create and connect socket
 #ifdef _WIN32
-        WSADATA wsaData;
-        if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
-            return false;
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+        return false;
 #endif
-        m_sockfd = socket(AF_INET, SOCK_STREAM, 0);
-        if (m_sockfd < 0)
-            return false;
+    m_sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_sockfd < 0)
+    {
+        m_sockfd = -1;
+        return false;
+    }
 
-        sockaddr_in peerAddr{};
-        peerAddr.sin_family = AF_INET;
-        peerAddr.sin_port = htons(m_port);
-        peerAddr.sin_addr.s_addr = inet_addr(m_ip.c_str());
+    // Requests are tiny; Nagle would hold them back while earlier data is unacknowledged.
+    int noDelay = 1;
+    setsockopt(m_sockfd, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&noDelay), sizeof(noDelay));
+    if (!setNonBlocking(m_sockfd))
+    {
+        disconnect();
+        return false;
+    }
 
-        if (connect(m_sockfd, (struct sockaddr *)&peerAddr, sizeof(peerAddr)) == -1)
-        {
-            disconnect();
-            return false;
-        }
+    sockaddr_in peerAddr{};
+    peerAddr.sin_family = AF_INET;
+    peerAddr.sin_port = htons(m_port);
+    peerAddr.sin_addr.s_addr = inet_addr(m_ip.c_str());
 
-        // 2. Perform BitTorrent handshake
-        if (!performHandshake())
+    m_stateSince = m_lastReceived = m_lastSent = m_lastDepthUpdate = Clock::now();
+    if (connect(m_sockfd, (struct sockaddr *)&peerAddr, sizeof(peerAddr)) == -1)
+    {
+        int error = lastSocketError();
+#ifdef _WIN32
+        bool inProgress = error == WSAEWOULDBLOCK;
+#else
+        bool inProgress = error == EINPROGRESS;
+#endif
+        if (!inProgress)
         {
             disconnect();
             return false;
         }
-        std::cout << "Handshake successful with " << m_ip << ":" << m_port << std::endl;
-
-        // 3. Receive initial Bitfield message
-        auto bitfieldMsg = receiveMessage();
-        if (bitfieldMsg.empty() || bitfieldMsg[0] != MSG_BITFIELD)
-        {
-            throw std::runtime_error("Expected bitfield message after handshake.");
-        }
+    }
 
-        // 4. Send Interested and wait for Unchoke
-        sendMessage(MSG_INTERESTED);
-        auto unchokeMsg = receiveMessage();
-        if (unchokeMsg.empty() || unchokeMsg[0] != MSG_UNCHOKE)
-        {
-            throw std::runtime_error("Peer did not send UNCHOKE.");
-        }
-        std::cout << "Peer unchoked us. Ready to download." << std::endl;
+    // Whether or not connect() finished already, the socket reports
+    // writable once it has, and finishConnect() sorts out the result.
+    m_state = State::Connecting;
+    if (m_loop.usesRing())
+    {
+        m_loop.pollOnce(m_sockfd, EventLoop::Writable, [this](int)
+                        { finishConnect(); });
     }
-    catch (const std::exception &e)
+    else
     {
-        std::cerr << "Error during connect/handshake: " << e.what() << std::endl;
-        disconnect();
-        return false;
+        m_loop.add(m_sockfd, EventLoop::Writable, [this](unsigned events)
+                   { onEvents(events); });
     }
     return true;
 }
 
-std::vector<uint8_t> PeerConnection::downloadPiece(size_t pieceIndex)
+void PeerConnection::requestPiece(size_t pieceIndex)
+{
+    Piece piece;
+    piece.index = pieceIndex;
+    piece.data.assign(m_torrent.getPieceSize(pieceIndex), 0);
+    piece.blocks.assign((piece.data.size() + PIECE_BLOCK_SIZE - 1) / PIECE_BLOCK_SIZE, BlockState::Missing);
+    piece.missing = piece.blocks.size();
+    piece.handedOver.assign(piece.blocks.size(), false);
+    addPiece(std::move(piece));
+}
+
+void PeerConnection::requestPiece(size_t pieceIndex, PartialPiece partial)
 {
-    size_t pieceSize = m_torrent.getPieceLength();
-    if (pieceIndex == m_torrent.getNumPieces() - 1)
+    size_t pieceSize = m_torrent.getPieceSize(pieceIndex);
+    size_t numBlocks = (pieceSize + PIECE_BLOCK_SIZE - 1) / PIECE_BLOCK_SIZE;
+    size_t received = static_cast<size_t>(std::count(partial.received.begin(), partial.received.end(), true));
+    if (partial.data.size() != pieceSize || partial.received.size() != numBlocks || received == numBlocks)
     {
-        pieceSize = m_torrent.getFileLength() % m_torrent.getPieceLength();
-        if (pieceSize == 0)
-            pieceSize = m_torrent.getPieceLength();
+        throw std::logic_error("Partial piece " + std::to_string(pieceIndex) + " does not fit the torrent.");
     }
 
-    std::vector<uint8_t> pieceData(pieceSize);
-    size_t downloaded = 0;
+    Piece piece;
+    piece.index = pieceIndex;
+    piece.data = std::move(partial.data);
+    piece.blocks.assign(numBlocks, BlockState::Missing);
+    for (size_t block = 0; block < numBlocks; ++block)
+    {
+        if (partial.received[block])
+            piece.blocks[block] = BlockState::Received;
+    }
+    piece.missing = numBlocks - received;
+    piece.received = received;
+    piece.sha1 = std::move(partial.sha1);
+    piece.hashed = partial.hashed;
+    piece.handedOver = std::move(partial.received);
+    addPiece(std::move(piece));
+}
 
-    std::deque<BlockRequest> requestQueue;
+std::optional<PartialPiece> PeerConnection::handOver(size_t pieceIndex)
+{
+    auto it = std::find_if(m_pieces.begin(), m_pieces.end(), [&](const Piece &piece)
+                           { return piece.index == pieceIndex; });
+    if (it == m_pieces.end() || it->received == 0)
+        return std::nullopt;
+
+    PartialPiece partial;
+    partial.data = it->data;
+    partial.received.assign(it->blocks.size(), false);
+    for (size_t block = 0; block < it->blocks.size(); ++block)
+    {
+        if (it->blocks[block] != BlockState::Received)
+            continue;
+        partial.received[block] = true;
+        partial.receivedBytes += std::min(PIECE_BLOCK_SIZE, it->data.size() - block * PIECE_BLOCK_SIZE);
+        it->handedOver[block] = true;
+    }
+    partial.sha1 = it->sha1;
+    partial.hashed = it->hashed;
+    return partial;
+}
 
-    for (size_t offset = 0; offset < pieceSize; offset += PIECE_BLOCK_SIZE)
+void PeerConnection::addPiece(Piece piece)
+{
+    bool assigned = std::any_of(m_pieces.begin(), m_pieces.end(), [&](const Piece &other)
+                                { return other.index == piece.index; });
+    if (!canTakePiece() || !hasPiece(piece.index) || assigned)
     {
-        size_t blockLength = std::min(PIECE_BLOCK_SIZE, pieceSize - offset);
-        requestQueue.push_back({pieceIndex, offset, blockLength});
-        requestBlock(pieceIndex, offset, blockLength);
+        throw std::logic_error("requestPiece called on a peer that cannot take piece " + std::to_string(piece.index));
     }
 
-    while (downloaded < pieceSize)
+    if (m_requests.empty())
+        m_lastReceived = Clock::now(); // The request timeout runs from here
+    m_pieces.push_back(std::move(piece));
+    m_idleSignalled = false;
+
+    requestMissingBlocks();
+    flushOutput();
+    signalIdle(); // there may be room for more still
+}
+
+void PeerConnection::cancelPiece(size_t pieceIndex)
+{
+    auto it = std::find_if(m_pieces.begin(), m_pieces.end(), [&](const Piece &piece)
+                           { return piece.index == pieceIndex; });
+    if (it == m_pieces.end())
+        return;
+
+    for (auto request = m_requests.begin(); request != m_requests.end();)
     {
-        auto msg = receiveMessage();
-        if (msg.empty() || msg[0] != MSG_PIECE)
+        if (request->pieceIndex != pieceIndex)
         {
-            throw std::runtime_error("Unexpected message received while downloading piece.");
+            ++request;
+            continue;
         }
+        sendBlockMessage(MSG_CANCEL, *it, request->block);
+        request = m_requests.erase(request);
+    }
 
-        uint32_t receivedIndex_n, receivedBegin_n;
-        std::memcpy(&receivedIndex_n, &msg[1], sizeof(uint32_t));
-        std::memcpy(&receivedBegin_n, &msg[5], sizeof(uint32_t));
+    size_t wasted = 0;
+    for (size_t block = 0; block < it->blocks.size(); ++block)
+    {
+        if (it->blocks[block] == BlockState::Received && !it->handedOver[block])
+            wasted += std::min(PIECE_BLOCK_SIZE, it->data.size() - block * PIECE_BLOCK_SIZE);
+    }
+    m_pieces.erase(it);
+    m_idleSignalled = false;
+    if (wasted > 0 && m_callbacks.onDuplicate)
+        m_callbacks.onDuplicate(*this, wasted);
+
+    requestMissingBlocks();
+    flushOutput();
+    signalIdle();
+}
 
-        size_t receivedIndex = ntohl(receivedIndex_n);
-        size_t receivedBegin = ntohl(receivedBegin_n);
-        size_t blockLength = msg.size() - 9;
+void PeerConnection::checkTimeout(Clock::time_point now)
+{
+    if (m_state == State::Connecting || m_state == State::Handshake)
+    {
+        if (now - m_stateSince > CONNECT_TIMEOUT)
+            fail("timed out during connect/handshake");
+        return;
+    }
+    if (m_state != State::Active)
+        return;
+
+    if (!m_requests.empty() && now - m_lastReceived > REQUEST_TIMEOUT)
+    {
+        fail("stopped sending requested blocks");
+        return;
+    }
+    if (!m_pieces.empty() && m_peerChoking && now - std::max(m_chokedSince, m_stateSince) > REQUEST_TIMEOUT)
+    {
+        fail("kept us choked with a piece in progress");
+        return;
+    }
+    if (now - m_lastDepthUpdate >= QUEUE_DEPTH_INTERVAL)
+    {
+        updateQueueDepth(now);
+        requestMissingBlocks();
+    }
+    if (now - m_lastSent > KEEPALIVE_INTERVAL)
+    {
+        appendUint32(m_output, 0); // A zero-length message keeps the connection open
+    }
+    if (!m_output.empty())
+        flushOutput();
+}
+
+bool PeerConnection::hasPiece(size_t pieceIndex) const
+{
+    return pieceIndex < m_peerBitfield.size() && m_peerBitfield[pieceIndex];
+}
+
+bool PeerConnection::isIdle() const
+{
+    return canTakePiece() && !m_peerChoking;
+}
+
+bool PeerConnection::canTakePiece() const
+{
+    if (m_state != State::Active)
+        return false;
+    size_t missing = 0;
+    for (const Piece &piece : m_pieces)
+    {
+        missing += piece.missing;
+    }
+    return missing < m_maxRequests;
+}
+
+std::vector<size_t> PeerConnection::piecesInProgress() const
+{
+    std::vector<size_t> indices;
+    for (const Piece &piece : m_pieces)
+    {
+        indices.push_back(piece.index);
+    }
+    return indices;
+}
+
+// --- Private Helper Methods ---
+
+void PeerConnection::onEvents(unsigned events)
+{
+    if (m_state == State::Connecting)
+    {
+        finishConnect();
+    }
+    else
+    {
+        if ((events & (EventLoop::Readable | EventLoop::Error)) && !readAvailable())
+            return;
+        processInput();
+        if (m_remoteClosed)
+            fail("connection closed by peer");
+    }
+    if (!isClosed())
+        flushOutput();
+}
+
+void PeerConnection::finishConnect()
+{
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(m_sockfd, SOL_SOCKET, SO_ERROR, reinterpret_cast<char *>(&error), &length) == -1)
+        error = lastSocketError();
+    if (error != 0)
+    {
+        fail("connect failed (" + std::string(std::strerror(error)) + ")");
+        return;
+    }
 
-        if (receivedIndex != pieceIndex)
+    std::vector<uint8_t> handshake(HANDSHAKE_SIZE);
+    handshake[0] = 19;
+    std::memcpy(&handshake[1], "BitTorrent protocol", 19);
+    std::memset(&handshake[20], 0, 8);
+    std::memcpy(&handshake[28], m_torrent.getInfoHashBinary().c_str(), 20);
+    std::memcpy(&handshake[48], m_ourPeerId.c_str(), 20);
+    m_output.insert(m_output.end(), handshake.begin(), handshake.end());
+
+    m_state = State::Handshake;
+    m_stateSince = Clock::now();
+    if (m_loop.usesRing())
+    {
+        receiveNext();
+        flushOutput();
+    }
+}
+
+bool PeerConnection::readAvailable()
+{
+    size_t budget = READ_BUDGET;
+    while (budget > 0)
+    {
+        size_t used = m_input.size();
+        m_input.resize(used + READ_CHUNK);
+        ssize_t received = recv(m_sockfd, reinterpret_cast<char *>(m_input.data() + used), READ_CHUNK, 0);
+        int error = lastSocketError();
+        m_input.resize(used + (received > 0 ? static_cast<size_t>(received) : 0));
+
+        if (received == 0)
         {
-            throw std::runtime_error("Received piece index does not match requested index.");
+            m_remoteClosed = true; // Whatever arrived before is still processed
+            break;
         }
+        if (received < 0)
+        {
+            if (wouldBlock(error))
+                break;
+#ifndef _WIN32
+            if (error == EINTR)
+                continue;
+#endif
+            fail("receive failed (" + std::string(std::strerror(error)) + ")");
+            return false;
+        }
+        m_lastReceived = Clock::now();
+        budget -= std::min(budget, static_cast<size_t>(received));
+    }
+    return true;
+}
 
-        std::memcpy(&pieceData[receivedBegin], &msg[9], blockLength);
-        downloaded += blockLength;
+void PeerConnection::receiveNext()
+{
+    m_loop.receive(m_sockfd, [this](int result, const uint8_t *data)
+                   { onReceived(result, data); });
+}
 
-        double progress = static_cast<double>(downloaded) / pieceSize * 100.0;
-        std::cout << "\rDownloading piece " << pieceIndex << ": " << std::fixed << std::setprecision(2) << progress << "%" << std::flush;
+void PeerConnection::onReceived(int result, const uint8_t *data)
+{
+    if (result < 0)
+    {
+        fail("receive failed (" + std::string(std::strerror(-result)) + ")");
+        return;
+    }
+    if (result == 0)
+    {
+        m_remoteClosed = true; // Whatever arrived before is still processed
+    }
+    else
+    {
+        m_input.insert(m_input.end(), data, data + result);
+        m_lastReceived = Clock::now();
     }
-    std::cout << std::endl;
 
-    if (!verifyPiece(pieceData, pieceIndex))
+    processInput();
+    if (isClosed())
+        return;
+    if (m_remoteClosed)
     {
-        throw std::runtime_error("Piece verification failed!");
+        fail("connection closed by peer");
+        return;
     }
+    receiveNext();
+    flushOutput();
+}
 
-    return pieceData;
+void PeerConnection::onSent(int result)
+{
+    m_sending = false;
+    if (result < 0)
+    {
+        fail("send failed (" + std::string(std::strerror(-result)) + ")");
+        return;
+    }
+    m_lastSent = Clock::now();
+    flushOutput();
 }
 
-// --- Private Helper Methods ---
+void PeerConnection::flushOutput()
+{
+    if (m_loop.usesRing())
+    {
+        // One send in flight at a time; whatever is queued meanwhile goes
+        // out together once it completes.
+        if (m_sending || m_output.empty())
+            return;
+        m_sending = true;
+        std::vector<uint8_t> data;
+        data.swap(m_output);
+        m_loop.send(m_sockfd, std::move(data), [this](int result)
+                    { onSent(result); });
+        return;
+    }
+
+    while (m_outputStart < m_output.size())
+    {
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL;
+#else
+        const int flags = 0;
+#endif
+        ssize_t sent = send(m_sockfd, reinterpret_cast<const char *>(m_output.data() + m_outputStart),
+                            m_output.size() - m_outputStart, flags);
+        if (sent < 0)
+        {
+            int error = lastSocketError();
+            if (wouldBlock(error))
+                break;
+#ifndef _WIN32
+            if (error == EINTR)
+                continue;
+#endif
+            fail("send failed (" + std::string(std::strerror(error)) + ")");
+            return;
+        }
+        m_outputStart += static_cast<size_t>(sent);
+        m_lastSent = Clock::now();
+    }
+    if (m_outputStart == m_output.size())
+    {
+        m_output.clear();
+        m_outputStart = 0;
+    }
+    updateInterest();
+}
+
+void PeerConnection::updateInterest()
+{
+    if (isClosed() || m_state == State::Connecting)
+        return;
+    // Always listen; ask for writability only while output is backed up.
+    unsigned events = EventLoop::Readable;
+    if (m_outputStart < m_output.size())
+        events |= EventLoop::Writable;
+    m_loop.modify(m_sockfd, events);
+}
 
-bool PeerConnection::performHandshake()
+void PeerConnection::processInput()
 {
-    char handshakeMsg[68];
-    handshakeMsg[0] = 19;
-    std::memcpy(&handshakeMsg[1], "BitTorrent protocol", 19);
-    std::memset(&handshakeMsg[20], 0, 8);
-    std::memcpy(&handshakeMsg[28], m_torrent.getInfoHashBinary().c_str(), 20);
-    std::memcpy(&handshakeMsg[48], m_ourPeerId.c_str(), 20);
+    if (m_state == State::Handshake)
+    {
+        if (m_input.size() - m_inputStart < HANDSHAKE_SIZE)
+            return;
+        const uint8_t *response = m_input.data() + m_inputStart;
+        if (response[0] != 19 || std::memcmp(&response[1], "BitTorrent protocol", 19) != 0 ||
+            std::memcmp(&response[28], m_torrent.getInfoHashBinary().c_str(), 20) != 0)
+        {
+            fail("handshake mismatch");
+            return;
+        }
+        m_inputStart += HANDSHAKE_SIZE;
+        m_state = State::Active;
+        m_stateSince = Clock::now();
+        m_peerBitfield.assign(m_torrent.getNumPieces(), false);
+        sendMessage(MSG_INTERESTED);
+    }
 
-    sendAll(m_sockfd, handshakeMsg, sizeof(handshakeMsg));
-    char response[68];
-    receiveAll(m_sockfd, response, sizeof(response));
+    // The largest message we accept is a bitfield or a block we asked for.
+    size_t maxLength = std::max(PIECE_BLOCK_SIZE + 9, (m_torrent.getNumPieces() + 7) / 8 + 1);
+    while (m_state == State::Active && m_input.size() - m_inputStart >= 4)
+    {
+        uint32_t length = readUint32(m_input.data() + m_inputStart);
+        if (length > maxLength)
+        {
+            fail("message too long (" + std::to_string(length) + " bytes)");
+            return;
+        }
+        if (m_input.size() - m_inputStart < 4 + static_cast<size_t>(length))
+            break;
+        size_t start = m_inputStart + 4;
+        m_inputStart = start + length;
+        handleMessage(m_input.data() + start, length);
+    }
 
-    if (std::memcmp(&response[28], m_torrent.getInfoHashBinary().c_str(), 20) != 0)
+    if (isClosed())
+        return;
+    // Keep the buffer from growing: drop what has been processed.
+    if (m_inputStart == m_input.size())
     {
-        return false;
+        m_input.clear();
+        m_inputStart = 0;
+    }
+    else if (m_inputStart >= READ_BUDGET)
+    {
+        m_input.erase(m_input.begin(), m_input.begin() + static_cast<std::ptrdiff_t>(m_inputStart));
+        m_inputStart = 0;
     }
-    return true;
 }
 
-void PeerConnection::sendMessage(uint8_t messageId, const std::vector<uint8_t> &payload)
+void PeerConnection::handleMessage(const uint8_t *message, size_t length)
 {
-    uint32_t len = htonl(1 + payload.size());
-    sendAll(m_sockfd, reinterpret_cast<const char *>(&len), 4);
-    sendAll(m_sockfd, reinterpret_cast<const char *>(&messageId), 1);
-    if (!payload.empty())
+    if (length == 0)
+        return; // keep-alive
+    bool firstMessage = !m_messageSeen;
+    m_messageSeen = true;
+
+    switch (message[0])
+    {
+    case MSG_CHOKE:
+        // A choking peer discards our outstanding requests; ask again once unchoked.
+        if (!m_peerChoking)
+            m_chokedSince = Clock::now();
+        m_peerChoking = true;
+        m_requests.clear();
+        for (Piece &piece : m_pieces)
+        {
+            std::replace(piece.blocks.begin(), piece.blocks.end(), BlockState::Requested, BlockState::Missing);
+            piece.missing = piece.blocks.size() - piece.received;
+            piece.firstMissing = 0;
+        }
+        break;
+
+    case MSG_UNCHOKE:
+        m_peerChoking = false;
+        m_idleSignalled = false;
+        requestMissingBlocks();
+        signalIdle();
+        break;
+
+    case MSG_HAVE:
+    {
+        if (length != 5)
+        {
+            fail("malformed HAVE message");
+            return;
+        }
+        size_t index = readUint32(message + 1);
+        if (index < m_peerBitfield.size() && !m_peerBitfield[index])
+        {
+            m_peerBitfield[index] = true;
+            if (m_callbacks.onHave)
+                m_callbacks.onHave(*this, index);
+            signalIdle();
+        }
+        break;
+    }
+
+    case MSG_BITFIELD:
     {
-        sendAll(m_sockfd, reinterpret_cast<const char *>(payload.data()), payload.size());
+        if (!firstMessage)
+        {
+            fail("BITFIELD after other messages");
+            return;
+        }
+        if (length - 1 != (m_peerBitfield.size() + 7) / 8)
+        {
+            fail("bitfield has the wrong length");
+            return;
+        }
+        for (size_t i = 0; i < m_peerBitfield.size(); ++i)
+        {
+            m_peerBitfield[i] = (message[1 + i / 8] >> (7 - i % 8)) & 1;
+        }
+        if (m_callbacks.onBitfield)
+            m_callbacks.onBitfield(*this, m_peerBitfield);
+        signalIdle();
+        break;
+    }
+
+    case MSG_PIECE:
+        handlePiece(message, length);
+        break;
+
+    default:
+        break; // Nothing else matters to a download-only client
     }
 }
 
-std::vector<uint8_t> PeerConnection::receiveMessage()
+void PeerConnection::handlePiece(const uint8_t *message, size_t length)
 {
-    uint32_t len_n;
-    receiveAll(m_sockfd, reinterpret_cast<char *>(&len_n), 4);
-    uint32_t len = ntohl(len_n);
+    if (length < 9)
+    {
+        fail("malformed PIECE message");
+        return;
+    }
+    size_t receivedIndex = readUint32(message + 1);
+    size_t receivedBegin = readUint32(message + 5);
+    size_t blockLength = length - 9;
+
+    // Blocks of a piece we no longer want can still be in flight.
+    auto it = std::find_if(m_pieces.begin(), m_pieces.end(), [&](const Piece &piece)
+                           { return piece.index == receivedIndex; });
+    if (it == m_pieces.end())
+    {
+        if (m_callbacks.onDuplicate)
+            m_callbacks.onDuplicate(*this, blockLength);
+        return;
+    }
+    Piece &piece = *it;
+
+    // Blocks may arrive in any order, but each must be one we asked for.
+    size_t pieceSize = piece.data.size();
+    size_t block = receivedBegin / PIECE_BLOCK_SIZE;
+    if (receivedBegin % PIECE_BLOCK_SIZE != 0 || block >= piece.blocks.size() ||
+        blockLength != std::min(PIECE_BLOCK_SIZE, pieceSize - receivedBegin))
+    {
+        fail("received block does not match any request");
+        return;
+    }
+    if (piece.blocks[block] == BlockState::Received)
+    {
+        if (m_callbacks.onDuplicate)
+            m_callbacks.onDuplicate(*this, blockLength);
+        return;
+    }
+
+    // Peers answer in order, so the request is almost always the oldest one.
+    // It is missing only if a choke in between cancelled it.
+    auto request = std::find_if(m_requests.begin(), m_requests.end(), [&](const Request &r)
+                                { return r.pieceIndex == receivedIndex && r.block == block; });
+    if (request != m_requests.end())
+    {
+        Clock::duration roundTrip = Clock::now() - request->sent;
+        if (!m_minRoundTrip || roundTrip < *m_minRoundTrip)
+            m_minRoundTrip = roundTrip;
+        m_requests.erase(request);
+    }
+    else
+    {
+        --piece.missing; // it was Missing again after the choke
+    }
+    m_bytesSinceUpdate += blockLength;
 
-    if (len == 0)
+    std::memcpy(&piece.data[receivedBegin], message + 9, blockLength);
+    piece.blocks[block] = BlockState::Received;
+    for (; piece.hashed < piece.blocks.size() && piece.blocks[piece.hashed] == BlockState::Received; ++piece.hashed)
     {
-        return {};
+        size_t offset = piece.hashed * PIECE_BLOCK_SIZE;
+        piece.sha1.update(&piece.data[offset], std::min(PIECE_BLOCK_SIZE, pieceSize - offset));
+    }
+    if (++piece.received == piece.blocks.size())
+    {
+        size_t pieceIndex = piece.index;
+        size_t handedOverBytes = 0;
+        for (size_t i = 0; i < piece.blocks.size(); ++i)
+        {
+            if (piece.handedOver[i])
+                handedOverBytes += std::min(PIECE_BLOCK_SIZE, pieceSize - i * PIECE_BLOCK_SIZE);
+        }
+        std::vector<uint8_t> pieceData = std::move(piece.data);
+        std::string digest = piece.sha1.final_bytes();
+        m_pieces.erase(it);
+        m_idleSignalled = false;
+        if (m_callbacks.onPiece)
+            m_callbacks.onPiece(*this, pieceIndex, std::move(pieceData), std::move(digest), handedOverBytes);
     }
 
-    std::vector<uint8_t> msg(len);
-    receiveAll(m_sockfd, reinterpret_cast<char *>(msg.data()), len);
-    return msg;
+    // Top the queue up at once, whichever piece the next blocks belong to.
+    requestMissingBlocks();
+    signalIdle();
 }
 
-void PeerConnection::requestBlock(size_t pieceIndex, size_t blockOffset, size_t blockLength)
+void PeerConnection::requestMissingBlocks()
 {
-    std::vector<uint8_t> payload(12);
-    uint32_t index_n = htonl(pieceIndex);
-    uint32_t begin_n = htonl(blockOffset);
-    uint32_t length_n = htonl(blockLength);
+    if (m_peerChoking || m_state != State::Active)
+        return;
+
+    for (Piece &piece : m_pieces)
+    {
+        for (; piece.missing > 0 && piece.firstMissing < piece.blocks.size(); ++piece.firstMissing)
+        {
+            if (m_requests.size() >= m_maxRequests)
+                return;
+            size_t block = piece.firstMissing;
+            if (piece.blocks[block] != BlockState::Missing)
+                continue;
+            sendBlockMessage(MSG_REQUEST, piece, block);
+            piece.blocks[block] = BlockState::Requested;
+            --piece.missing;
+            m_requests.push_back(Request{piece.index, block, Clock::now()});
+        }
+    }
+    // Fewer blocks left to ask for than the queue holds.
+    if (m_requests.size() < m_maxRequests)
+        m_starved = true;
+}
 
-    std::memcpy(&payload[0], &index_n, 4);
-    std::memcpy(&payload[4], &begin_n, 4);
-    std::memcpy(&payload[8], &length_n, 4);
+void PeerConnection::updateQueueDepth(Clock::time_point now)
+{
+    auto elapsed = std::chrono::duration<double>(now - m_lastDepthUpdate).count();
+    bool hadWork = !m_starved;
+    size_t bytes = m_bytesSinceUpdate;
+    m_lastDepthUpdate = now;
+    m_bytesSinceUpdate = 0;
+    m_starved = false;
+    if (!m_minRoundTrip || bytes == 0 || elapsed <= 0)
+        return;
+
+    // Twice the bandwidth-delay product: enough to keep the pipe full while
+    // the rate is being measured, and room to grow when the queue itself
+    // was the limit.
+    double rate = static_cast<double>(bytes) / elapsed;
+    double roundTrip = std::chrono::duration<double>(*m_minRoundTrip).count();
+    size_t depth = static_cast<size_t>(2 * rate * roundTrip / PIECE_BLOCK_SIZE) + 1;
+    depth = std::clamp(depth, MIN_REQUESTS, MAX_REQUESTS);
+    // While short of work the measured rate says little about the link.
+    if (hadWork || depth > m_maxRequests)
+        m_maxRequests = depth;
+}
 
-    sendMessage(MSG_REQUEST, payload);
+void PeerConnection::signalIdle()
+{
+    if (m_idleSignalled || !isIdle() || !m_callbacks.onIdle)
+        return;
+    m_idleSignalled = true;
+    m_callbacks.onIdle(*this);
 }
 
-bool PeerConnection::verifyPiece(const std::vector<uint8_t> &pieceData, size_t pieceIndex)
+void PeerConnection::sendBlockMessage(uint8_t messageId, const Piece &piece, size_t block)
 {
-    SHA1 sha1;
-    sha1.update(std::string(pieceData.begin(), pieceData.end()));
-    std::string calculatedHash = sha1.final();
+    // REQUEST and CANCEL share a payload: index, begin, length.
+    size_t offset = block * PIECE_BLOCK_SIZE;
+    std::vector<uint8_t> payload;
+    payload.reserve(12);
+    appendUint32(payload, static_cast<uint32_t>(piece.index));
+    appendUint32(payload, static_cast<uint32_t>(offset));
+    appendUint32(payload, static_cast<uint32_t>(std::min(PIECE_BLOCK_SIZE, piece.data.size() - offset)));
+    sendMessage(messageId, payload);
+}
 
-    std::string expectedHash = m_torrent.getPieceHashes().substr(pieceIndex * 20, 20);
+void PeerConnection::sendMessage(uint8_t messageId, const std::vector<uint8_t> &payload)
+{
+    // Queued only; flushOutput() sends everything queued in as few calls as possible.
+    appendUint32(m_output, static_cast<uint32_t>(1 + payload.size()));
+    m_output.push_back(messageId);
+    m_output.insert(m_output.end(), payload.begin(), payload.end());
+}
 
-    return calculatedHash == expectedHash;
+void PeerConnection::fail(const std::string &reason)
+{
+    if (isClosed())
+        return;
+    disconnect();
+    if (m_callbacks.onClosed)
+        m_callbacks.onClosed(*this, reason);
 }
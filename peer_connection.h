@@ -1,45 +1,218 @@
 #pragma once
 
+#include <chrono>
+#include <cstddef> // For size_t
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
 #include <string>
 #include <vector>
-#include <cstdint>
+#include "lib/sha1.hpp"
 
 // Forward-declare TorrentFile to avoid circular dependencies
 class TorrentFile;
+class EventLoop;
 
-// Represents a connection to a single peer
+// The blocks of a piece one connection has received so far, handed to
+// another connection that fetches the same piece in endgame, so that one
+// requests only the rest.
+struct PartialPiece
+{
+    std::vector<uint8_t> data;
+    std::vector<bool> received; // by block
+    size_t receivedBytes = 0;
+    SHA1 sha1;         // over the leading received blocks
+    size_t hashed = 0; // blocks fed to sha1
+};
+
+// Represents a connection to a single peer. The socket is non-blocking and
+// driven by an EventLoop: the connection moves through connect, handshake
+// and message exchange as readiness events arrive, or as receives and sends
+// complete when the loop runs on io_uring, and reports what happens through
+// Callbacks. Several pieces can be assigned at once; their blocks
+// are requested through one queue of outstanding requests, so the pipe
+// stays full across piece boundaries. The queue's depth follows the
+// measured bandwidth-delay product of the connection.
 class PeerConnection
 {
 public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Callbacks
+    {
+        // The peer has us unchoked and room for another piece (see
+        // requestPiece). Not repeated until a piece is assigned or completes,
+        // or the peer unchokes us again.
+        std::function<void(PeerConnection &)> onIdle;
+        // The peer's BITFIELD arrived (at most once, right after the handshake).
+        std::function<void(PeerConnection &, const std::vector<bool> &pieces)> onBitfield;
+        // The peer announced a piece it did not have before.
+        std::function<void(PeerConnection &, size_t pieceIndex)> onHave;
+        // Every block of an assigned piece has arrived. Not yet verified;
+        // `digest` is its raw 20-byte SHA-1, hashed as the blocks came in.
+        // `handedOverBytes` of it were handed over from or to another
+        // connection (see handOver) rather than fetched by this one alone.
+        std::function<void(PeerConnection &, size_t pieceIndex, std::vector<uint8_t> data, std::string digest,
+                           size_t handedOverBytes)>
+            onPiece;
+        // Bytes were received that are not needed: blocks of a cancelled
+        // piece that were not handed over, or a block that arrived twice.
+        std::function<void(PeerConnection &, size_t bytes)> onDuplicate;
+        // The connection failed or was dropped; the assigned pieces, if any,
+        // are left unfinished. The object must not be used afterwards except
+        // to destroy it (outside its own callbacks).
+        std::function<void(PeerConnection &, const std::string &reason)> onClosed;
+    };
+
     // Constructor requires info about the peer, the torrent, and our client ID
-    PeerConnection(std::string ip, int port, const TorrentFile &torrent, std::string ourPeerId);
+    PeerConnection(std::string ip, int port, const TorrentFile &torrent, std::string ourPeerId, EventLoop &loop,
+                   Callbacks callbacks);
     ~PeerConnection();
 
-    // Establishes the TCP connection, performs the handshake, and prepares for downloading.
-    // Returns true on success.
-    bool connectAndHandshake();
+    PeerConnection(const PeerConnection &) = delete;
+    PeerConnection &operator=(const PeerConnection &) = delete;
+
+    // Starts a non-blocking connect; the handshake follows on its own.
+    // Returns false if the connection could not even be started.
+    bool start();
+
+    // Queues the blocks of `pieceIndex` for requesting, behind those of
+    // pieces already assigned; they go out while the peer has us unchoked.
+    // Only valid while canTakePiece(), for a piece the peer has and that is
+    // not already assigned.
+    void requestPiece(size_t pieceIndex);
+    // The same, starting from the blocks another connection handed over.
+    void requestPiece(size_t pieceIndex, PartialPiece partial);
+
+    // Copies out the blocks of an assigned piece received so far, for
+    // another connection to start from; nothing if there are none yet.
+    // The piece stays assigned here.
+    std::optional<PartialPiece> handOver(size_t pieceIndex);
 
-    // Downloads a single, complete piece from the peer.
-    // Throws an exception on error.
-    std::vector<uint8_t> downloadPiece(size_t pieceIndex);
+    // Drops an assigned piece, e.g. because another peer delivered it, and
+    // sends CANCEL for its outstanding requests. Blocks already received
+    // for it count as duplicates, unless they were handed over.
+    void cancelPiece(size_t pieceIndex);
 
-    // Closes the connection.
+    // Drops connections that have stalled: slow connects or handshakes,
+    // peers that stop sending blocks we asked for and peers that keep us
+    // choked with a piece in progress. Also sends keep-alives and resizes
+    // the request queue. Meant to be called about once a second.
+    void checkTimeout(Clock::time_point now);
+
+    // Closes the connection without calling onClosed.
     void disconnect();
 
+    bool hasPiece(size_t pieceIndex) const;
+    bool isClosed() const { return m_state == State::Closed; }
+    // The handshake is done and fewer blocks are waiting to be requested
+    // than fit in the request queue.
+    bool canTakePiece() const;
+    // Unchoked, and canTakePiece().
+    bool isIdle() const;
+    // Assigned pieces not yet complete, oldest first.
+    std::vector<size_t> piecesInProgress() const;
+    const std::string &address() const { return m_address; }
+
 private:
+    enum class State
+    {
+        Idle,       // not started
+        Connecting, // connect() in progress
+        Handshake,  // handshake sent, waiting for the peer's
+        Active,     // exchanging messages
+        Closed
+    };
+    enum class BlockState : uint8_t
+    {
+        Missing,
+        Requested,
+        Received
+    };
+
     // --- Private helper methods ---
-    bool performHandshake();
+    void onEvents(unsigned events);
+    void finishConnect();
+    bool readAvailable();
+    void receiveNext();
+    void onReceived(int result, const uint8_t *data);
+    void onSent(int result);
+    void flushOutput();
+    void updateInterest();
+    void processInput();
+    void handleMessage(const uint8_t *message, size_t length);
+    void handlePiece(const uint8_t *message, size_t length);
+    void requestMissingBlocks();
+    void updateQueueDepth(Clock::time_point now);
+    void signalIdle();
+    struct Piece;
+    void addPiece(Piece piece);
+    void sendBlockMessage(uint8_t messageId, const Piece &piece, size_t block);
     void sendMessage(uint8_t messageId, const std::vector<uint8_t> &payload = {});
-    std::vector<uint8_t> receiveMessage();
-    void requestBlock(size_t pieceIndex, size_t blockOffset, size_t blockLength);
-    bool verifyPiece(const std::vector<uint8_t> &pieceData, size_t pieceIndex);
+    void fail(const std::string &reason);
 
     // --- Member variables ---
     std::string m_ip;
     int m_port;
+    std::string m_address; // "ip:port", for messages
     const TorrentFile &m_torrent;
     std::string m_ourPeerId;
+    EventLoop &m_loop;
+    Callbacks m_callbacks;
 
     int m_sockfd = -1; // Socket file descriptor
+    State m_state = State::Idle;
+    std::vector<uint8_t> m_input;
+    size_t m_inputStart = 0; // bytes of m_input already processed
+    bool m_remoteClosed = false; // the peer has shut down its side
+    std::vector<uint8_t> m_output;
+    size_t m_outputStart = 0; // bytes of m_output already sent
+    bool m_sending = false;   // ring mode: a send is in flight
+    Clock::time_point m_stateSince;
+    Clock::time_point m_lastReceived;
+    Clock::time_point m_lastSent;
+
+    bool m_peerChoking = true;
+    Clock::time_point m_chokedSince;
     std::vector<bool> m_peerBitfield;
-};
\ No newline at end of file
+    bool m_messageSeen = false; // BITFIELD is only valid as the first message
+
+    bool m_idleSignalled = false; // onIdle called since the last assignment, completion or unchoke
+
+    // Assigned pieces, oldest first; their blocks are requested in that order.
+    struct Piece
+    {
+        size_t index;
+        std::vector<uint8_t> data;
+        std::vector<BlockState> blocks;
+        size_t missing;          // blocks neither requested nor received
+        size_t received = 0;
+        size_t firstMissing = 0; // no Missing block before this one
+        // Blocks arrive in any order; the hash advances over the contiguous
+        // received prefix, so only the tail is left once the last one is in.
+        SHA1 sha1;
+        size_t hashed = 0; // blocks fed to sha1
+        // Received blocks another connection also holds, because they were
+        // handed over from or to this one; losing them wastes nothing.
+        std::vector<bool> handedOver;
+    };
+    std::vector<Piece> m_pieces;
+
+    // Outstanding block requests, oldest first.
+    struct Request
+    {
+        size_t pieceIndex;
+        size_t block;
+        Clock::time_point sent;
+    };
+    std::deque<Request> m_requests;
+    size_t m_maxRequests; // queue depth
+
+    // Bandwidth-delay product estimate: the lowest request round trip seen,
+    // and bytes received since the queue depth was last updated.
+    std::optional<Clock::duration> m_minRoundTrip;
+    size_t m_bytesSinceUpdate = 0;
+    bool m_starved = false; // ran out of blocks to request since the update
+    Clock::time_point m_lastDepthUpdate;
+};
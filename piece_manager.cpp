@@ -0,0 +1,126 @@
+#include "piece_manager.h"
+
+#include <stdexcept>
+#include <string>
+#include <utility> // For std::swap
+
+PiecePicker::PiecePicker(size_t numPieces)
+    : m_availability(numPieces, 0), m_state(numPieces, State::Unwanted), m_buckets(1), m_slot(numPieces, 0),
+      m_random(std::random_device{}())
+{
+}
+
+void PiecePicker::addPeer(const std::vector<bool> &pieces)
+{
+    for (size_t i = 0; i < pieces.size() && i < m_availability.size(); ++i)
+    {
+        if (pieces[i])
+            changeAvailability(i, true);
+    }
+}
+
+void PiecePicker::removePeer(const std::vector<bool> &pieces)
+{
+    for (size_t i = 0; i < pieces.size() && i < m_availability.size(); ++i)
+    {
+        if (pieces[i])
+            changeAvailability(i, false);
+    }
+}
+
+void PiecePicker::addHave(size_t pieceIndex)
+{
+    if (pieceIndex < m_availability.size())
+        changeAvailability(pieceIndex, true);
+}
+
+void PiecePicker::want(size_t pieceIndex)
+{
+    if (pieceIndex >= m_state.size())
+        throw std::out_of_range("Piece index " + std::to_string(pieceIndex) + " out of range.");
+    if (m_state[pieceIndex] == State::Wanted)
+        return;
+    if (m_state[pieceIndex] == State::InFlight)
+        --m_inFlight;
+    m_state[pieceIndex] = State::Wanted;
+    ++m_wanted;
+    insert(pieceIndex);
+}
+
+std::optional<size_t> PiecePicker::pick(const std::vector<bool> &peerPieces)
+{
+    // Bucket 0 is skipped: no connected peer, this one included, has those.
+    for (size_t count = 1; count < m_buckets.size(); ++count)
+    {
+        for (size_t pieceIndex : m_buckets[count])
+        {
+            if (pieceIndex < peerPieces.size() && peerPieces[pieceIndex])
+            {
+                erase(pieceIndex);
+                m_state[pieceIndex] = State::InFlight;
+                --m_wanted;
+                ++m_inFlight;
+                return pieceIndex;
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+void PiecePicker::received(size_t pieceIndex)
+{
+    if (pieceIndex < m_state.size() && m_state[pieceIndex] == State::InFlight)
+    {
+        m_state[pieceIndex] = State::Unwanted;
+        --m_inFlight;
+    }
+}
+
+bool PiecePicker::wantedAvailable() const
+{
+    for (size_t count = 1; count < m_buckets.size(); ++count)
+    {
+        if (!m_buckets[count].empty())
+            return true;
+    }
+    return false;
+}
+
+void PiecePicker::changeAvailability(size_t pieceIndex, bool increase)
+{
+    if (!increase && m_availability[pieceIndex] == 0)
+        return;
+    bool bucketed = m_state[pieceIndex] == State::Wanted;
+    if (bucketed)
+        erase(pieceIndex);
+    if (increase)
+        ++m_availability[pieceIndex];
+    else
+        --m_availability[pieceIndex];
+    if (bucketed)
+        insert(pieceIndex);
+}
+
+void PiecePicker::insert(size_t pieceIndex)
+{
+    size_t count = m_availability[pieceIndex];
+    if (count >= m_buckets.size())
+        m_buckets.resize(count + 1);
+    std::vector<size_t> &bucket = m_buckets[count];
+
+    // Append, then swap into a random position to keep the bucket shuffled.
+    bucket.push_back(pieceIndex);
+    size_t slot = std::uniform_int_distribution<size_t>(0, bucket.size() - 1)(m_random);
+    std::swap(bucket[slot], bucket.back());
+    m_slot[bucket.back()] = bucket.size() - 1;
+    m_slot[pieceIndex] = slot;
+}
+
+void PiecePicker::erase(size_t pieceIndex)
+{
+    std::vector<size_t> &bucket = m_buckets[m_availability[pieceIndex]];
+    size_t slot = m_slot[pieceIndex];
+    bucket[slot] = bucket.back();
+    m_slot[bucket[slot]] = slot;
+    bucket.pop_back();
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef> // For size_t
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <vector>
+
+// Decides which piece a peer fetches next: the rarest wanted piece it has,
+// i.e. the one the fewest connected peers can serve, so pieces held by only
+// a few peers are secured before those peers leave. Availability comes from
+// the peers' BITFIELD and HAVE messages.
+//
+// Wanted pieces sit in buckets by availability, each bucket in random order,
+// so a change in availability moves one piece between buckets in O(1) and
+// peers picking from equally rare pieces spread out instead of all taking
+// the same one. Not thread-safe.
+class PiecePicker
+{
+public:
+    explicit PiecePicker(size_t numPieces);
+
+    // A peer with `pieces` connected, or went away.
+    void addPeer(const std::vector<bool> &pieces);
+    void removePeer(const std::vector<bool> &pieces);
+    // A connected peer announced a piece it did not have before.
+    void addHave(size_t pieceIndex);
+
+    // Marks a piece as needing to be fetched: initially, after a peer
+    // dropped it, or after it failed verification.
+    void want(size_t pieceIndex);
+
+    // Returns the rarest wanted piece among `peerPieces`, now counted as in
+    // flight, or nothing if the peer has none of them.
+    std::optional<size_t> pick(const std::vector<bool> &peerPieces);
+
+    // An in-flight piece arrived in full; it is no longer wanted unless
+    // want() is called for it again.
+    void received(size_t pieceIndex);
+
+    size_t availability(size_t pieceIndex) const { return m_availability[pieceIndex]; }
+    // Some connected peer has a wanted piece.
+    bool wantedAvailable() const;
+    // Wanted pieces not yet handed to a peer.
+    size_t wantedCount() const { return m_wanted; }
+    // Pieces handed to a peer and not yet received.
+    size_t inFlightCount() const { return m_inFlight; }
+
+private:
+    enum class State : uint8_t
+    {
+        Unwanted,
+        Wanted,
+        InFlight
+    };
+
+    void changeAvailability(size_t pieceIndex, bool increase);
+    void insert(size_t pieceIndex);
+    void erase(size_t pieceIndex);
+
+    std::vector<uint32_t> m_availability;
+    std::vector<State> m_state;
+    // m_buckets[n] holds the wanted pieces n connected peers have;
+    // m_slot[i] is piece i's position in its bucket.
+    std::vector<std::vector<size_t>> m_buckets;
+    std::vector<size_t> m_slot;
+    size_t m_wanted = 0;
+    size_t m_inFlight = 0;
+    std::mt19937 m_random;
+};
@@ -0,0 +1,50 @@
+#include "recheck.h"
+#include "torrent_file.h"
+#include "thread_pool.h"
+#include "lib/sha1.hpp"
+
+#include <algorithm> // For std::min, std::max
+
+namespace
+{
+    // Pieces handed to one pool task. Several multiples of the SIMD lane
+    // count, so every hash_many() call fills its lanes.
+    const size_t PIECES_PER_TASK = 64;
+}
+
+std::vector<bool> recheckPieces(const TorrentFile &torrent, std::string_view content, size_t threadCount)
+{
+    size_t numPieces = torrent.getNumPieces();
+    size_t pieceLength = torrent.getPieceLength();
+    std::string_view expectedHashes = torrent.getPieceHashes();
+
+    // Only pieces whose bytes are all present can match.
+    size_t available = content.size() >= torrent.getFileLength() ? numPieces : content.size() / pieceLength;
+
+    // One byte per piece: tasks write neighbouring entries concurrently,
+    // which std::vector<bool> cannot do safely.
+    std::vector<char> valid(numPieces, 0);
+    {
+        ThreadPool pool(threadCount);
+        for (size_t first = 0; first < available; first += PIECES_PER_TASK)
+        {
+            size_t last = std::min(first + PIECES_PER_TASK, available);
+            pool.submit([&, first, last]
+                        {
+                std::vector<std::string_view> pieces;
+                pieces.reserve(last - first);
+                for (size_t i = first; i < last; ++i)
+                {
+                    pieces.push_back(content.substr(i * pieceLength, torrent.getPieceSize(i)));
+                }
+
+                std::vector<std::string> digests = SHA1::hash_many(pieces);
+                for (size_t i = first; i < last; ++i)
+                {
+                    valid[i] = digests[i - first] == expectedHashes.substr(i * 20, 20);
+                } });
+        }
+    }
+
+    return std::vector<bool>(valid.begin(), valid.end());
+}
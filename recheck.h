@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef> // For size_t
+#include <string_view>
+#include <vector>
+
+class TorrentFile;
+
+// Hashes the pieces of existing content for `torrent` on `threadCount`
+// threads and returns which ones match the torrent's piece hashes.
+// `content` is typically a MappedFile view of a previous download; pieces
+// it does not fully cover are reported as missing.
+std::vector<bool> recheckPieces(const TorrentFile &torrent, std::string_view content, size_t threadCount);
@@ -0,0 +1,211 @@
+#include "resume_data.h"
+#include "lib/sha1.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+
+// File layout, all integers little-endian:
+//
+//   "BTRESUME" u32 version
+//   info hash (20 bytes)
+//   u32 piece count, piece bitfield (high bit first, as in the wire protocol)
+//   u32 file count, then per file: u64 size, i64 mtime
+//   u32 partial piece count, then per piece: u32 index, u32 block count, block bitfield
+//   SHA-1 of everything above (20 bytes)
+namespace
+{
+    const char MAGIC[8] = {'B', 'T', 'R', 'E', 'S', 'U', 'M', 'E'};
+    const uint32_t VERSION = 1;
+    const size_t HASH_SIZE = 20;
+
+    void putU32(std::string &out, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+            out += static_cast<char>(value >> (8 * i));
+    }
+
+    void putU64(std::string &out, uint64_t value)
+    {
+        for (int i = 0; i < 8; ++i)
+            out += static_cast<char>(value >> (8 * i));
+    }
+
+    void putBits(std::string &out, const std::vector<bool> &bits)
+    {
+        putU32(out, static_cast<uint32_t>(bits.size()));
+        size_t start = out.size();
+        out.append((bits.size() + 7) / 8, '\0');
+        for (size_t i = 0; i < bits.size(); ++i)
+        {
+            if (bits[i])
+                out[start + i / 8] |= static_cast<char>(0x80 >> (i % 8));
+        }
+    }
+
+    // Bounds-checked sequential reads over the record; throws on truncation.
+    class Reader
+    {
+    public:
+        explicit Reader(std::string_view data) : m_data(data) {}
+
+        std::string_view take(size_t length)
+        {
+            if (length > m_data.size() - m_offset)
+                throw std::runtime_error("Resume record is truncated.");
+            std::string_view bytes = m_data.substr(m_offset, length);
+            m_offset += length;
+            return bytes;
+        }
+
+        uint64_t u64(size_t width = 8)
+        {
+            std::string_view bytes = take(width);
+            uint64_t value = 0;
+            for (size_t i = 0; i < width; ++i)
+                value |= static_cast<uint64_t>(static_cast<unsigned char>(bytes[i])) << (8 * i);
+            return value;
+        }
+
+        uint32_t u32() { return static_cast<uint32_t>(u64(4)); }
+
+        std::vector<bool> bits()
+        {
+            uint32_t count = u32();
+            std::string_view bytes = take((static_cast<size_t>(count) + 7) / 8);
+            std::vector<bool> result(count);
+            for (size_t i = 0; i < count; ++i)
+                result[i] = (static_cast<unsigned char>(bytes[i / 8]) & (0x80 >> (i % 8))) != 0;
+            return result;
+        }
+
+        bool atEnd() const { return m_offset == m_data.size(); }
+
+    private:
+        std::string_view m_data;
+        size_t m_offset = 0;
+    };
+
+    std::string checksum(std::string_view data)
+    {
+        SHA1 sha1;
+        sha1.update(data.data(), data.size());
+        return sha1.final_bytes();
+    }
+}
+
+bool ResumeData::loadFromFile(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    try
+    {
+        if (content.size() < HASH_SIZE)
+            throw std::runtime_error("Resume record is truncated.");
+        std::string_view body = std::string_view(content).substr(0, content.size() - HASH_SIZE);
+        if (checksum(body) != std::string_view(content).substr(body.size()))
+            throw std::runtime_error("Resume record checksum mismatch.");
+
+        Reader reader(body);
+        if (reader.take(sizeof(MAGIC)) != std::string_view(MAGIC, sizeof(MAGIC)) || reader.u32() != VERSION)
+            throw std::runtime_error("Not a resume record of a supported version.");
+
+        ResumeData record;
+        record.infoHash = std::string(reader.take(HASH_SIZE));
+        record.pieces = reader.bits();
+
+        uint32_t fileCount = reader.u32();
+        for (uint32_t i = 0; i < fileCount; ++i)
+        {
+            FileStamp stamp;
+            stamp.size = reader.u64();
+            stamp.mtime = static_cast<int64_t>(reader.u64());
+            record.files.push_back(stamp);
+        }
+
+        uint32_t partialCount = reader.u32();
+        for (uint32_t i = 0; i < partialCount; ++i)
+        {
+            PartialPiece partial;
+            partial.pieceIndex = reader.u32();
+            partial.blocks = reader.bits();
+            record.partialPieces.push_back(std::move(partial));
+        }
+
+        if (!reader.atEnd())
+            throw std::runtime_error("Unexpected data after resume record.");
+
+        *this = std::move(record);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Warning: Ignoring resume record " << path << ": " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool ResumeData::saveToFile(const std::string &path) const
+{
+    if (infoHash.size() != HASH_SIZE)
+        return false;
+
+    std::string out(MAGIC, sizeof(MAGIC));
+    putU32(out, VERSION);
+    out += infoHash;
+    putBits(out, pieces);
+
+    putU32(out, static_cast<uint32_t>(files.size()));
+    for (const FileStamp &stamp : files)
+    {
+        putU64(out, stamp.size);
+        putU64(out, static_cast<uint64_t>(stamp.mtime));
+    }
+
+    putU32(out, static_cast<uint32_t>(partialPieces.size()));
+    for (const PartialPiece &partial : partialPieces)
+    {
+        putU32(out, static_cast<uint32_t>(partial.pieceIndex));
+        putBits(out, partial.blocks);
+    }
+    out += checksum(out);
+
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.write(out.data(), out.size()) || !file.flush())
+            return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tempPath, path, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tempPath, ec);
+        return false;
+    }
+    return true;
+}
+
+std::optional<ResumeData::FileStamp> ResumeData::stampFile(const std::string &path)
+{
+    std::error_code ec;
+    uintmax_t size = std::filesystem::file_size(path, ec);
+    if (ec)
+        return std::nullopt;
+    std::filesystem::file_time_type mtime = std::filesystem::last_write_time(path, ec);
+    if (ec)
+        return std::nullopt;
+
+    FileStamp stamp;
+    stamp.size = size;
+    stamp.mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count();
+    return stamp;
+}
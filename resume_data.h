@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef> // For size_t
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Compact binary record kept next to a download so a restart can trust the
+// previous state instead of rehashing everything. It is only valid while the
+// data files still have the sizes and modification times stored in it.
+struct ResumeData
+{
+    // Size and modification time of one data file when the record was written.
+    struct FileStamp
+    {
+        uint64_t size = 0;
+        int64_t mtime = 0; // nanoseconds on the filesystem clock
+
+        bool operator==(const FileStamp &other) const { return size == other.size && mtime == other.mtime; }
+        bool operator!=(const FileStamp &other) const { return !(*this == other); }
+    };
+
+    // Blocks already on disk for a piece that is not complete yet.
+    struct PartialPiece
+    {
+        size_t pieceIndex = 0;
+        std::vector<bool> blocks;
+    };
+
+    std::string infoHash; // 20 raw bytes
+    std::vector<bool> pieces;
+    std::vector<FileStamp> files;
+    std::vector<PartialPiece> partialPieces;
+
+    // Reads a record. Returns false if it is missing, truncated, corrupt or
+    // written by an incompatible version.
+    bool loadFromFile(const std::string &path);
+
+    // Writes the record through a temporary file and a rename, so a crash
+    // never leaves a half-written record behind. Returns true on success.
+    bool saveToFile(const std::string &path) const;
+
+    // Current stamp of `path`, or nullopt if it does not exist.
+    static std::optional<FileStamp> stampFile(const std::string &path);
+
+    // Where the record for the download at `dataPath` lives.
+    static std::string pathFor(const std::string &dataPath) { return dataPath + ".resume"; }
+};
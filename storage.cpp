@@ -0,0 +1,463 @@
+#include "storage.h"
+#include "uring_storage.h"
+
+#include <algorithm> // For std::min
+#include <cstring>   // For memcpy, strerror
+#include <iostream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <winioctl.h> // For FSCTL_SET_SPARSE
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+AllocationMode parseAllocationMode(const std::string &name)
+{
+    if (name == "full")
+        return AllocationMode::Full;
+    if (name == "sparse")
+        return AllocationMode::Sparse;
+    if (name == "none")
+        return AllocationMode::None;
+    throw std::runtime_error("Unknown allocation mode '" + name + "' (expected full, sparse or none).");
+}
+
+StorageBackend parseStorageBackend(const std::string &name)
+{
+    if (name == "pwrite")
+        return StorageBackend::Pwrite;
+    if (name == "mmap")
+        return StorageBackend::Mmap;
+    if (name == "uring")
+        return StorageBackend::Uring;
+    throw std::runtime_error("Unknown storage backend '" + name + "' (expected pwrite, mmap or uring).");
+}
+
+std::unique_ptr<Storage> makeStorage(StorageBackend backend)
+{
+    if (backend == StorageBackend::Mmap)
+        return std::make_unique<MmapStorage>();
+    if (backend == StorageBackend::Uring)
+        return std::make_unique<UringStorage>();
+    return std::make_unique<FileStorage>();
+}
+
+void Storage::writeBatch(const std::vector<WriteRequest> &requests)
+{
+    for (const WriteRequest &request : requests)
+    {
+        write(request.offset, request.data, request.length);
+    }
+}
+
+FileStorage::~FileStorage()
+{
+    close();
+}
+
+MmapStorage::~MmapStorage()
+{
+    close();
+}
+
+bool MmapStorage::isOpen() const
+{
+    return m_open;
+}
+
+void MmapStorage::checkRange(uint64_t offset, size_t length) const
+{
+    if (offset > m_size || length > m_size - offset)
+    {
+        throw std::out_of_range("Range is outside the mapped output file.");
+    }
+}
+
+void MmapStorage::write(uint64_t offset, const void *data, size_t length)
+{
+    checkRange(offset, length);
+    if (length > 0)
+        std::memcpy(m_data + offset, data, length);
+}
+
+#ifdef _WIN32
+
+namespace
+{
+    // Opens or creates the data file and sets up its space as `mode` says.
+    // Returns INVALID_HANDLE_VALUE after printing the reason on failure.
+    HANDLE openDataFile(const std::string &filepath, uint64_t length, AllocationMode mode)
+    {
+        HANDLE file = CreateFileA(filepath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            std::cerr << "Error: Cannot open " << filepath << " (error " << GetLastError() << ")." << std::endl;
+            return INVALID_HANDLE_VALUE;
+        }
+
+        bool ok = true;
+        if (mode == AllocationMode::Full)
+        {
+            // Reserves clusters for the whole length without writing zeros.
+            FILE_ALLOCATION_INFO allocation;
+            allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(length);
+            ok = SetFileInformationByHandle(file, FileAllocationInfo, &allocation, sizeof(allocation)) != 0;
+        }
+        else if (mode == AllocationMode::Sparse)
+        {
+            DWORD returned = 0;
+            ok = DeviceIoControl(file, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &returned, nullptr) != 0;
+        }
+
+        if (ok && mode != AllocationMode::None)
+        {
+            LARGE_INTEGER size;
+            size.QuadPart = static_cast<LONGLONG>(length);
+            ok = SetFilePointerEx(file, size, nullptr, FILE_BEGIN) && SetEndOfFile(file);
+        }
+        if (!ok)
+        {
+            std::cerr << "Error: Cannot allocate " << length << " bytes for " << filepath << " (error " << GetLastError() << ")." << std::endl;
+            CloseHandle(file);
+            return INVALID_HANDLE_VALUE;
+        }
+        return file;
+    }
+}
+
+bool FileStorage::open(const std::string &filepath, uint64_t length, AllocationMode mode)
+{
+    close();
+
+    HANDLE file = openDataFile(filepath, length, mode);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    m_handle = file;
+    return true;
+}
+
+void FileStorage::close()
+{
+    if (m_handle != nullptr)
+        CloseHandle(m_handle);
+    m_handle = nullptr;
+}
+
+bool FileStorage::isOpen() const
+{
+    return m_handle != nullptr;
+}
+
+void FileStorage::write(uint64_t offset, const void *data, size_t length)
+{
+    const char *bytes = static_cast<const char *>(data);
+    while (length > 0)
+    {
+        // WriteFile takes a 32-bit length and the position through OVERLAPPED.
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(length, 1u << 30));
+        OVERLAPPED position{};
+        position.Offset = static_cast<DWORD>(offset);
+        position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD written = 0;
+        if (!WriteFile(m_handle, bytes, chunk, &written, &position) || written == 0)
+        {
+            throw std::runtime_error("Failed to write to output file.");
+        }
+        bytes += written;
+        offset += written;
+        length -= written;
+    }
+}
+
+void FileStorage::read(uint64_t offset, void *data, size_t length) const
+{
+    char *bytes = static_cast<char *>(data);
+    while (length > 0)
+    {
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(length, 1u << 30));
+        OVERLAPPED position{};
+        position.Offset = static_cast<DWORD>(offset);
+        position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD received = 0;
+        if (!ReadFile(m_handle, bytes, chunk, &received, &position) || received == 0)
+        {
+            throw std::runtime_error("Failed to read from output file.");
+        }
+        bytes += received;
+        offset += received;
+        length -= received;
+    }
+}
+
+void FileStorage::sync()
+{
+    if (!FlushFileBuffers(m_handle))
+    {
+        throw std::runtime_error("Failed to flush output file.");
+    }
+}
+
+bool MmapStorage::open(const std::string &filepath, uint64_t length, AllocationMode mode)
+{
+    close();
+
+    if (mode == AllocationMode::None)
+        mode = AllocationMode::Sparse; // The view needs the whole length behind it
+    HANDLE file = openDataFile(filepath, length, mode);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    m_fileHandle = file;
+    m_open = true;
+    if (length == 0)
+        return true; // Nothing to map, but an empty file is still a valid file
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+    void *data = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0) : nullptr;
+    m_mappingHandle = mapping;
+    if (data == nullptr)
+    {
+        std::cerr << "Error: Cannot map " << filepath << " (error " << GetLastError() << ")." << std::endl;
+        close();
+        return false;
+    }
+    m_data = static_cast<char *>(data);
+    m_size = static_cast<size_t>(length);
+    return true;
+}
+
+void MmapStorage::close()
+{
+    if (m_data != nullptr)
+        UnmapViewOfFile(m_data);
+    if (m_mappingHandle != nullptr)
+        CloseHandle(m_mappingHandle);
+    if (m_fileHandle != nullptr)
+        CloseHandle(m_fileHandle);
+    m_data = nullptr;
+    m_size = 0;
+    m_mappingHandle = nullptr;
+    m_fileHandle = nullptr;
+    m_open = false;
+}
+
+void MmapStorage::read(uint64_t offset, void *data, size_t length) const
+{
+    checkRange(offset, length);
+    if (length > 0)
+        std::memcpy(data, m_data + offset, length);
+}
+
+void MmapStorage::sync()
+{
+    // FlushViewOfFile only starts writing the dirty pages; FlushFileBuffers waits for them.
+    if ((m_data != nullptr && !FlushViewOfFile(m_data, 0)) || !FlushFileBuffers(m_fileHandle))
+    {
+        throw std::runtime_error("Failed to flush output file.");
+    }
+}
+
+#else
+
+namespace
+{
+    // Reserves real blocks for [0, length) and returns 0 or an errno value.
+    int preallocate(int fd, uint64_t length)
+    {
+        if (length == 0)
+            return 0;
+#if defined(__linux__)
+        if (fallocate(fd, 0, 0, static_cast<off_t>(length)) == 0)
+            return 0;
+        if (errno != EOPNOTSUPP && errno != ENOSYS)
+            return errno;
+        // The filesystem has no fallocate(2); posix_fallocate writes the blocks instead.
+#endif
+#if defined(__APPLE__)
+        fstore_t store = {F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, static_cast<off_t>(length), 0};
+        if (fcntl(fd, F_PREALLOCATE, &store) == -1)
+        {
+            store.fst_flags = F_ALLOCATEALL; // Contiguous space is a nicety, not a requirement
+            if (fcntl(fd, F_PREALLOCATE, &store) == -1)
+                return errno;
+        }
+        return ftruncate(fd, static_cast<off_t>(length)) == 0 ? 0 : errno;
+#else
+        return posix_fallocate(fd, 0, static_cast<off_t>(length));
+#endif
+    }
+
+    // Opens or creates the data file and sets up its space as `mode` says.
+    // Returns -1 after printing the reason on failure.
+    int openDataFile(const std::string &filepath, uint64_t length, AllocationMode mode)
+    {
+        int fd = ::open(filepath.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd == -1)
+        {
+            std::cerr << "Error: Cannot open " << filepath << ": " << std::strerror(errno) << std::endl;
+            return -1;
+        }
+
+        int error = 0;
+        if (mode == AllocationMode::Full)
+        {
+            error = preallocate(fd, length);
+        }
+        if (error == 0 && mode != AllocationMode::None)
+        {
+            // Sets the exact length: grows sparse files (a hole that later writes
+            // fill in) and drops anything beyond the end of a preallocated one.
+            if (ftruncate(fd, static_cast<off_t>(length)) == -1)
+                error = errno;
+        }
+        if (error != 0)
+        {
+            std::cerr << "Error: Cannot allocate " << length << " bytes for " << filepath << ": " << std::strerror(error) << std::endl;
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+}
+
+bool FileStorage::open(const std::string &filepath, uint64_t length, AllocationMode mode)
+{
+    close();
+
+    m_fd = openDataFile(filepath, length, mode);
+    return m_fd != -1;
+}
+
+void FileStorage::close()
+{
+    if (m_fd != -1)
+        ::close(m_fd);
+    m_fd = -1;
+}
+
+bool FileStorage::isOpen() const
+{
+    return m_fd != -1;
+}
+
+void FileStorage::write(uint64_t offset, const void *data, size_t length)
+{
+    const char *bytes = static_cast<const char *>(data);
+    while (length > 0)
+    {
+        ssize_t written = pwrite(m_fd, bytes, length, static_cast<off_t>(offset));
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written <= 0)
+        {
+            throw std::runtime_error(std::string("Failed to write to output file: ") + std::strerror(errno));
+        }
+        bytes += written;
+        offset += static_cast<uint64_t>(written);
+        length -= static_cast<size_t>(written);
+    }
+}
+
+void FileStorage::read(uint64_t offset, void *data, size_t length) const
+{
+    char *bytes = static_cast<char *>(data);
+    while (length > 0)
+    {
+        ssize_t received = pread(m_fd, bytes, length, static_cast<off_t>(offset));
+        if (received == -1 && errno == EINTR)
+            continue;
+        if (received <= 0)
+        {
+            throw std::runtime_error(received == 0 ? std::string("Read past the end of output file.")
+                                                   : std::string("Failed to read from output file: ") + std::strerror(errno));
+        }
+        bytes += received;
+        offset += static_cast<uint64_t>(received);
+        length -= static_cast<size_t>(received);
+    }
+}
+
+void FileStorage::sync()
+{
+    if (fsync(m_fd) == -1)
+    {
+        throw std::runtime_error(std::string("Failed to flush output file: ") + std::strerror(errno));
+    }
+}
+
+bool MmapStorage::open(const std::string &filepath, uint64_t length, AllocationMode mode)
+{
+    close();
+
+    if (mode == AllocationMode::None)
+        mode = AllocationMode::Sparse; // The mapping needs the whole length behind it
+    int fd = openDataFile(filepath, length, mode);
+    if (fd == -1)
+        return false;
+    if (length == 0)
+    {
+        ::close(fd);
+        m_open = true;
+        return true; // Nothing to map, but an empty file is still a valid file
+    }
+
+    void *data = mmap(nullptr, static_cast<size_t>(length), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd); // The mapping keeps its own reference to the file
+    if (data == MAP_FAILED)
+    {
+        std::cerr << "Error: Cannot map " << filepath << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Pieces land all over the file, and each write covers whole blocks, so
+    // read-ahead would only fetch pages that are about to be overwritten.
+    madvise(data, static_cast<size_t>(length), MADV_RANDOM);
+
+    m_data = static_cast<char *>(data);
+    m_size = static_cast<size_t>(length);
+    m_open = true;
+    return true;
+}
+
+void MmapStorage::close()
+{
+    if (m_data != nullptr)
+        munmap(m_data, m_size);
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+}
+
+void MmapStorage::read(uint64_t offset, void *data, size_t length) const
+{
+    checkRange(offset, length);
+    if (length == 0)
+        return;
+
+    // Under MADV_RANDOM each page would fault in on its own; ask for the
+    // whole range at once instead (madvise wants a page-aligned start).
+    static const uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t start = offset - offset % pageSize;
+    madvise(m_data + start, static_cast<size_t>(offset + length - start), MADV_WILLNEED);
+
+    std::memcpy(data, m_data + offset, length);
+}
+
+void MmapStorage::sync()
+{
+    if (m_data != nullptr && msync(m_data, m_size, MS_SYNC) == -1)
+    {
+        throw std::runtime_error(std::string("Failed to flush output file: ") + std::strerror(errno));
+    }
+}
+
+#endif
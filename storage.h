@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef> // For size_t
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// How the data file's space is set up when it is opened.
+enum class AllocationMode
+{
+    Full,   // reserve every byte up front: no fragmentation, no ENOSPC mid-download
+    Sparse, // set the final length without allocating; blocks appear as pieces land
+    None    // leave the file alone; it grows as pieces are written
+};
+
+// Parses "full", "sparse" or "none". Throws on anything else.
+AllocationMode parseAllocationMode(const std::string &name);
+
+// Read-write access to the data file of a download by absolute offset, so
+// pieces can be stored as soon as they are verified, in any order. Writes to
+// different ranges may come from different threads at the same time.
+class Storage
+{
+public:
+    virtual ~Storage() = default;
+
+    // Opens `filepath` for reading and writing, creating it if needed, and
+    // prepares `length` bytes of space as `mode` says. Existing content is
+    // kept. Returns true on success; the reason for a failure is printed.
+    virtual bool open(const std::string &filepath, uint64_t length, AllocationMode mode = AllocationMode::Sparse) = 0;
+
+    // Closes the file. Data not yet synced may still be in the OS cache.
+    virtual void close() = 0;
+
+    virtual bool isOpen() const = 0;
+
+    // Writes `length` bytes at `offset`. Throws on failure.
+    virtual void write(uint64_t offset, const void *data, size_t length) = 0;
+
+    struct WriteRequest
+    {
+        uint64_t offset;
+        const void *data;
+        size_t length;
+    };
+
+    // Writes every request; backends that can keep several writes in flight
+    // override this. Throws on the first failure.
+    virtual void writeBatch(const std::vector<WriteRequest> &requests);
+
+    // Reads `length` bytes at `offset` into `data`, e.g. to serve a peer.
+    // Throws on failure or if the range is past the end of the file.
+    virtual void read(uint64_t offset, void *data, size_t length) const = 0;
+
+    // Flushes everything written so far to stable storage. Throws on failure.
+    virtual void sync() = 0;
+};
+
+// The ways Storage can reach the disk.
+enum class StorageBackend
+{
+    Pwrite, // FileStorage: positioned write calls
+    Mmap,   // MmapStorage: copies into a shared mapping of the file
+    Uring   // UringStorage: batches of writes through io_uring (Linux only)
+};
+
+// Parses "pwrite", "mmap" or "uring". Throws on anything else.
+StorageBackend parseStorageBackend(const std::string &name);
+
+// Creates an unopened Storage of the given kind.
+std::unique_ptr<Storage> makeStorage(StorageBackend backend);
+
+// Storage through pwrite/pread (WriteFile/ReadFile on Windows).
+class FileStorage : public Storage
+{
+public:
+    FileStorage() = default;
+    ~FileStorage() override;
+
+    FileStorage(const FileStorage &) = delete;
+    FileStorage &operator=(const FileStorage &) = delete;
+
+    bool open(const std::string &filepath, uint64_t length, AllocationMode mode = AllocationMode::Sparse) override;
+    void close() override;
+    bool isOpen() const override;
+    void write(uint64_t offset, const void *data, size_t length) override;
+    void read(uint64_t offset, void *data, size_t length) const override;
+    void sync() override;
+
+protected:
+#ifdef _WIN32
+    void *m_handle = nullptr;
+#else
+    int m_fd = -1;
+#endif
+};
+
+// Storage through a shared read-write mapping of the whole file. Writes are
+// plain copies into the mapping and the page cache does the write-back, so
+// there are no system calls per piece; reads come straight from the mapping.
+// The mapping needs the file at its final length, so AllocationMode::None
+// behaves like Sparse. An I/O error or a full disk under a sparse file shows
+// up as SIGBUS rather than an exception; use AllocationMode::Full to rule
+// out the latter.
+class MmapStorage : public Storage
+{
+public:
+    MmapStorage() = default;
+    ~MmapStorage() override;
+
+    MmapStorage(const MmapStorage &) = delete;
+    MmapStorage &operator=(const MmapStorage &) = delete;
+
+    bool open(const std::string &filepath, uint64_t length, AllocationMode mode = AllocationMode::Sparse) override;
+    void close() override;
+    bool isOpen() const override;
+    void write(uint64_t offset, const void *data, size_t length) override;
+    void read(uint64_t offset, void *data, size_t length) const override;
+    void sync() override;
+
+private:
+    void checkRange(uint64_t offset, size_t length) const;
+
+    char *m_data = nullptr;
+    size_t m_size = 0;
+    bool m_open = false;
+#ifdef _WIN32
+    void *m_fileHandle = nullptr;
+    void *m_mappingHandle = nullptr;
+#endif
+};
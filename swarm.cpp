@@ -0,0 +1,498 @@
+#include "swarm.h"
+#include "peer_connection.h"
+#include "piece_manager.h"
+#include "torrent_file.h"
+
+#include <algorithm> // For std::max, std::find, std::remove
+#include <exception>
+#include <iostream>
+#include <thread>
+
+namespace
+{
+    // How often each shard looks for stalled peers.
+    const auto HOUSEKEEPING_INTERVAL = std::chrono::seconds(1);
+    // In endgame, a piece is fetched by more than one peer once it has been
+    // in flight this many times longer than the average piece, and by at
+    // most ENDGAME_MAX_PEERS at once.
+    const int ENDGAME_STRAGGLER_FACTOR = 2;
+    const size_t ENDGAME_MAX_PEERS = 3;
+    // Deliveries timed before the average piece time is trusted, and the
+    // number it averages over once running. Until then, a piece counts as
+    // overdue after ENDGAME_DEFAULT_STRAGGLE.
+    const size_t ENDGAME_MIN_SAMPLES = 4;
+    const size_t PIECE_TIME_WINDOW = 8;
+    const auto ENDGAME_DEFAULT_STRAGGLE = std::chrono::seconds(5);
+}
+
+// One reactor thread. Owns its connections outright: they are created,
+// driven and destroyed only on this thread, and reported to the coordinator
+// as Events keyed by the peer id the coordinator chose.
+class Swarm::Shard
+{
+public:
+    Shard(const TorrentFile &torrent, const std::string &ourPeerId, MpscQueue<Event> &events, EventLoop &coordinator,
+          EventLoop::Backend network)
+        : m_torrent(torrent), m_ourPeerId(ourPeerId), m_events(events), m_coordinator(coordinator), m_loop(network),
+          m_thread([this]
+                   { run(); })
+    {
+    }
+
+    ~Shard()
+    {
+        post(Command{Command::Kind::Stop});
+        m_thread.join();
+    }
+
+    // Safe from any thread.
+    void post(Command command)
+    {
+        m_commands.push(std::move(command));
+        m_loop.wake();
+    }
+
+private:
+    void run()
+    {
+        // Errors cannot unwind past the thread; hand them to the coordinator,
+        // which rethrows them from poll(), and stop serving peers.
+        try
+        {
+            serve();
+        }
+        catch (...)
+        {
+            Event event{Event::Kind::Failed, 0};
+            event.error = std::current_exception();
+            send(std::move(event));
+        }
+        m_peers.clear(); // their sockets belong to m_loop, so close them here
+    }
+
+    void serve()
+    {
+        auto lastHousekeeping = PeerConnection::Clock::now();
+        while (!m_stopping)
+        {
+            m_loop.runOnce(HOUSEKEEPING_INTERVAL);
+
+            while (std::optional<Command> command = m_commands.pop())
+            {
+                handleCommand(*command);
+            }
+
+            auto now = PeerConnection::Clock::now();
+            if (now - lastHousekeeping >= HOUSEKEEPING_INTERVAL)
+            {
+                lastHousekeeping = now;
+                for (const auto &[id, peer] : m_peers)
+                {
+                    peer->checkTimeout(now);
+                }
+            }
+
+            // Outside any handler, so a peer is never destroyed by its own callback.
+            for (auto it = m_peers.begin(); it != m_peers.end();)
+            {
+                if (it->second->isClosed())
+                    it = m_peers.erase(it);
+                else
+                    ++it;
+            }
+        }
+    }
+
+    void handleCommand(Command &command)
+    {
+        switch (command.kind)
+        {
+        case Command::Kind::Connect:
+            connect(command.peer, std::move(command.ip), command.port);
+            break;
+        case Command::Kind::Assign:
+        {
+            auto it = m_peers.find(command.peer);
+            // The peer may have closed, or shrunk its request queue, since the
+            // coordinator last heard from it; if it closed, the Closed event
+            // is on its way.
+            if (it == m_peers.end() || !it->second->canTakePiece() || !it->second->hasPiece(command.pieceIndex))
+            {
+                Event event{Event::Kind::Rejected, command.peer};
+                event.pieceIndex = command.pieceIndex;
+                send(std::move(event));
+                break;
+            }
+            if (command.partial)
+                it->second->requestPiece(command.pieceIndex, std::move(*command.partial));
+            else
+                it->second->requestPiece(command.pieceIndex);
+            break;
+        }
+        case Command::Kind::Share:
+        {
+            // Whatever happens, `target` is waiting to hear about the piece.
+            Event event{Event::Kind::Partial, command.target};
+            event.pieceIndex = command.pieceIndex;
+            auto it = m_peers.find(command.peer);
+            if (it != m_peers.end() && !it->second->isClosed())
+            {
+                if (std::optional<PartialPiece> partial = it->second->handOver(command.pieceIndex))
+                    event.partial = std::make_shared<PartialPiece>(std::move(*partial));
+            }
+            send(std::move(event));
+            break;
+        }
+        case Command::Kind::Cancel:
+        {
+            auto it = m_peers.find(command.peer);
+            if (it != m_peers.end() && !it->second->isClosed())
+                it->second->cancelPiece(command.pieceIndex);
+            break;
+        }
+        case Command::Kind::Stop:
+            m_stopping = true;
+            break;
+        }
+    }
+
+    void connect(uint64_t id, std::string ip, int port)
+    {
+        PeerConnection::Callbacks callbacks;
+        callbacks.onIdle = [this, id](PeerConnection &)
+        { send(Event{Event::Kind::Idle, id}); };
+        callbacks.onBitfield = [this, id](PeerConnection &, const std::vector<bool> &pieces)
+        {
+            Event event{Event::Kind::Bitfield, id};
+            event.pieces = pieces;
+            send(std::move(event));
+        };
+        callbacks.onHave = [this, id](PeerConnection &, size_t pieceIndex)
+        {
+            Event event{Event::Kind::Have, id};
+            event.pieceIndex = pieceIndex;
+            send(std::move(event));
+        };
+        callbacks.onPiece = [this, id](PeerConnection &, size_t pieceIndex, std::vector<uint8_t> data,
+                                       std::string digest, size_t handedOverBytes)
+        {
+            Event event{Event::Kind::Piece, id};
+            event.pieceIndex = pieceIndex;
+            event.data = std::move(data);
+            event.digest = std::move(digest);
+            event.bytes = handedOverBytes;
+            send(std::move(event));
+        };
+        callbacks.onDuplicate = [this, id](PeerConnection &, size_t bytes)
+        {
+            Event event{Event::Kind::Duplicate, id};
+            event.bytes = bytes;
+            send(std::move(event));
+        };
+        callbacks.onClosed = [this, id](PeerConnection &peer, const std::string &reason)
+        {
+            Event event{Event::Kind::Closed, id};
+            event.unfinished = peer.piecesInProgress();
+            event.reason = reason;
+            send(std::move(event));
+        };
+
+        auto peer = std::make_unique<PeerConnection>(std::move(ip), port, m_torrent, m_ourPeerId, m_loop,
+                                                     std::move(callbacks));
+        if (!peer->start())
+        {
+            Event event{Event::Kind::Closed, id};
+            event.reason = "could not start connecting";
+            send(std::move(event));
+            return;
+        }
+        m_peers.emplace(id, std::move(peer));
+    }
+
+    void send(Event event)
+    {
+        m_events.push(std::move(event));
+        m_coordinator.wake();
+    }
+
+    const TorrentFile &m_torrent;
+    const std::string &m_ourPeerId;
+    MpscQueue<Event> &m_events;
+    EventLoop &m_coordinator;
+
+    EventLoop m_loop;
+    MpscQueue<Command> m_commands;
+    std::unordered_map<uint64_t, std::unique_ptr<PeerConnection>> m_peers;
+    bool m_stopping = false;
+    std::thread m_thread; // last, so it starts once everything above exists
+};
+
+Swarm::Swarm(const TorrentFile &torrent, std::string ourPeerId, const Options &options, PiecePicker &picker,
+             Callbacks callbacks)
+    : m_torrent(torrent), m_ourPeerId(std::move(ourPeerId)), m_options(options), m_picker(picker),
+      m_callbacks(std::move(callbacks))
+{
+    for (size_t i = 0; i < std::max<size_t>(1, m_options.shards); ++i)
+    {
+        m_shards.push_back(std::make_unique<Shard>(m_torrent, m_ourPeerId, m_events, m_loop, m_options.network));
+    }
+}
+
+Swarm::~Swarm() = default; // each Shard stops and joins its thread
+
+void Swarm::addPeer(std::string ip, int port)
+{
+    // A tracker asked again mostly repeats peers we already have.
+    std::string address = ip + ":" + std::to_string(port);
+    for (const auto &[id, peer] : m_peers)
+    {
+        if (peer.address == address)
+            return;
+    }
+    for (const auto &[candidateIp, candidatePort] : m_candidates)
+    {
+        if (candidateIp == ip && candidatePort == port)
+            return;
+    }
+    m_candidates.emplace_back(std::move(ip), port);
+    connectMore();
+}
+
+void Swarm::poll(std::chrono::milliseconds timeout)
+{
+    m_loop.runOnce(timeout);
+
+    while (std::optional<Event> event = m_events.pop())
+    {
+        handleEvent(*event);
+    }
+
+    // Pieces turn into stragglers by time alone, not by any event.
+    if (inEndgame())
+        assignWork();
+    connectMore();
+}
+
+bool Swarm::inEndgame() const
+{
+    return m_picker.wantedCount() == 0 && !m_downloading.empty();
+}
+
+void Swarm::assignWork()
+{
+    for (auto &[id, peer] : m_peers)
+    {
+        offerWork(id, peer);
+    }
+}
+
+void Swarm::handleEvent(Event &event)
+{
+    // Also for peers already gone.
+    if (event.kind == Event::Kind::Rejected || (event.kind == Event::Kind::Partial && !m_peers.count(event.peer)))
+    {
+        release(event.peer, event.pieceIndex);
+        assignWork();
+        return;
+    }
+    if (event.kind == Event::Kind::Duplicate)
+    {
+        m_duplicateBytes += event.bytes;
+        return;
+    }
+    if (event.kind == Event::Kind::Failed)
+        std::rethrow_exception(event.error);
+
+    auto it = m_peers.find(event.peer);
+    if (it == m_peers.end())
+        return;
+    RemotePeer &peer = it->second;
+
+    switch (event.kind)
+    {
+    case Event::Kind::Bitfield:
+        m_picker.removePeer(peer.pieces);
+        peer.pieces = std::move(event.pieces);
+        m_picker.addPeer(peer.pieces);
+        offerWork(event.peer, peer);
+        break;
+    case Event::Kind::Have:
+        if (event.pieceIndex < peer.pieces.size() && !peer.pieces[event.pieceIndex])
+        {
+            peer.pieces[event.pieceIndex] = true;
+            m_picker.addHave(event.pieceIndex);
+        }
+        offerWork(event.peer, peer);
+        break;
+    case Event::Kind::Idle:
+        peer.idle = true;
+        offerWork(event.peer, peer);
+        break;
+    case Event::Kind::Piece:
+    {
+        auto downloading = m_downloading.find(event.pieceIndex);
+        if (downloading == m_downloading.end() ||
+            std::find(downloading->second.peers.begin(), downloading->second.peers.end(), event.peer) ==
+                downloading->second.peers.end())
+        {
+            // Another peer got there first, and the Cancel came too late.
+            m_duplicateBytes += event.data.size() - event.bytes;
+            break;
+        }
+        for (uint64_t other : downloading->second.peers)
+        {
+            auto otherPeer = m_peers.find(other);
+            if (other == event.peer || otherPeer == m_peers.end())
+                continue;
+            Command command{Command::Kind::Cancel, other};
+            command.pieceIndex = event.pieceIndex;
+            m_shards[otherPeer->second.shard]->post(std::move(command));
+        }
+        auto elapsed = std::chrono::steady_clock::now() - downloading->second.since;
+        // A plain mean over the first deliveries, then a moving average.
+        m_piecesTimed = std::min(m_piecesTimed + 1, PIECE_TIME_WINDOW);
+        m_pieceTime += (elapsed - m_pieceTime) / static_cast<long>(m_piecesTimed);
+        m_downloading.erase(downloading);
+        m_picker.received(event.pieceIndex);
+        m_callbacks.onPiece(event.pieceIndex, std::move(event.data), std::move(event.digest));
+        break;
+    }
+    case Event::Kind::Closed:
+        std::cerr << "Peer " << peer.address << ": " << event.reason << std::endl;
+        m_picker.removePeer(peer.pieces);
+        m_peers.erase(it);
+        if (!event.unfinished.empty())
+        {
+            for (size_t pieceIndex : event.unfinished)
+            {
+                release(event.peer, pieceIndex);
+            }
+            assignWork(); // someone else may be waiting for exactly those pieces
+        }
+        break;
+    case Event::Kind::Partial:
+    {
+        auto downloading = m_downloading.find(event.pieceIndex);
+        if (downloading == m_downloading.end() ||
+            std::find(downloading->second.peers.begin(), downloading->second.peers.end(), event.peer) ==
+                downloading->second.peers.end())
+        {
+            // Delivered while the blocks were on their way; the Cancel sent
+            // then found nothing to cancel, so the peer still wants work.
+            peer.idle = true;
+            offerWork(event.peer, peer);
+            break;
+        }
+        Command command{Command::Kind::Assign, event.peer};
+        command.pieceIndex = event.pieceIndex;
+        if (event.partial)
+        {
+            m_handedOverBytes += event.partial->receivedBytes;
+            command.partial = std::move(event.partial);
+        }
+        m_shards[peer.shard]->post(std::move(command));
+        break;
+    }
+    case Event::Kind::Rejected:
+    case Event::Kind::Duplicate:
+    case Event::Kind::Failed:
+        break;
+    }
+}
+
+void Swarm::offerWork(uint64_t peerId, RemotePeer &peer)
+{
+    if (!peer.idle)
+        return;
+    std::optional<size_t> piece = m_picker.pick(peer.pieces);
+    if (!piece && inEndgame())
+        piece = pickDuplicate(peerId, peer);
+    if (piece)
+    {
+        Download &download = m_downloading[*piece];
+        peer.idle = false; // until it reports room for more
+        // A duplicate: the peer fetching it longest hands over what it has,
+        // and the Assign follows once that arrives (as Partial). Peers that
+        // are gone but still listed only wait for their Rejected or Partial.
+        auto source = std::find_if(download.peers.begin(), download.peers.end(), [&](uint64_t id)
+                                   { return m_peers.count(id) > 0; });
+        if (source != download.peers.end())
+        {
+            Command command{Command::Kind::Share, *source};
+            command.pieceIndex = *piece;
+            command.target = peerId;
+            m_shards[m_peers.at(*source).shard]->post(std::move(command));
+            download.peers.push_back(peerId);
+            return;
+        }
+        if (download.peers.empty())
+            download.since = std::chrono::steady_clock::now();
+        download.peers.push_back(peerId);
+        Command command{Command::Kind::Assign, peerId};
+        command.pieceIndex = *piece;
+        m_shards[peer.shard]->post(std::move(command));
+    }
+}
+
+std::optional<size_t> Swarm::pickDuplicate(uint64_t peerId, const RemotePeer &peer) const
+{
+    // Duplicating pieces that are merely on schedule would only waste
+    // bandwidth; until a few pieces have arrived there is no schedule, only
+    // a fixed limit, so short downloads and resumes get endgame too.
+    std::chrono::steady_clock::duration overdue = ENDGAME_DEFAULT_STRAGGLE;
+    if (m_piecesTimed >= ENDGAME_MIN_SAMPLES)
+        overdue = m_pieceTime * ENDGAME_STRAGGLER_FACTOR;
+    auto straggling = std::chrono::steady_clock::now() - overdue;
+
+    // The longest overdue piece this peer can help with.
+    std::optional<size_t> best;
+    auto oldest = straggling;
+    for (const auto &[pieceIndex, download] : m_downloading)
+    {
+        const std::vector<uint64_t> &peers = download.peers;
+        if (download.since < oldest && peers.size() < ENDGAME_MAX_PEERS && pieceIndex < peer.pieces.size() &&
+            peer.pieces[pieceIndex] && std::find(peers.begin(), peers.end(), peerId) == peers.end())
+        {
+            best = pieceIndex;
+            oldest = download.since;
+        }
+    }
+    return best;
+}
+
+void Swarm::release(uint64_t peerId, size_t pieceIndex)
+{
+    auto it = m_downloading.find(pieceIndex);
+    if (it == m_downloading.end())
+        return; // delivered by someone else in the meantime
+    std::vector<uint64_t> &peers = it->second.peers;
+    peers.erase(std::remove(peers.begin(), peers.end(), peerId), peers.end());
+    if (peers.empty())
+    {
+        // Nobody else is on it, so it is wanted again.
+        m_downloading.erase(it);
+        m_picker.want(pieceIndex);
+    }
+}
+
+void Swarm::connectMore()
+{
+    while (m_peers.size() < m_options.maxConnections && !m_candidates.empty())
+    {
+        auto [ip, port] = std::move(m_candidates.front());
+        m_candidates.pop_front();
+
+        uint64_t id = m_nextPeerId++;
+        RemotePeer peer;
+        peer.shard = m_nextShard;
+        m_nextShard = (m_nextShard + 1) % m_shards.size();
+        peer.address = ip + ":" + std::to_string(port);
+        peer.pieces.assign(m_torrent.getNumPieces(), false);
+        m_peers.emplace(id, std::move(peer));
+
+        Command command{Command::Kind::Connect, id};
+        command.ip = std::move(ip);
+        command.port = port;
+        m_shards[m_peers[id].shard]->post(std::move(command));
+    }
+}
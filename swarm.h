@@ -0,0 +1,192 @@
+#pragma once
+
+#include "event_loop.h"
+#include "mpsc_queue.h"
+
+#include <chrono>
+#include <cstddef> // For size_t
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class PiecePicker;
+class TorrentFile;
+struct PartialPiece;
+
+// Downloads from many peers at once. Connections are spread over `shards`
+// reactor threads, each with its own EventLoop, sockets, buffers and
+// timers, so peer I/O scales across cores. The thread that owns the Swarm
+// is the coordinator: it keeps the PiecePicker up to date with what every
+// peer has, hands pieces to idle peers and sees every result, and all
+// Callbacks run on it. Shards and coordinator share no state; they talk
+// only through lock-free queues (MpscQueue) and wake each other with
+// EventLoop::wake.
+//
+// Once every wanted piece has been handed out, the Swarm is in endgame: a
+// peer with nothing else to do gets a copy of a piece that has been in
+// flight much longer than pieces usually take, and whichever peer finishes
+// it first wins, so one slow peer cannot hold up the end of the download.
+// The copy starts from the blocks the first peer already has, so only the
+// rest are fetched twice. The others are told to CANCEL the rest of their
+// requests for it.
+class Swarm
+{
+public:
+    struct Options
+    {
+        size_t maxConnections = 50; // across all shards
+        size_t shards = 1;          // reactor threads
+        // How the shards drive their sockets; Ring needs EventLoop::ringAvailable().
+        EventLoop::Backend network = EventLoop::Backend::Readiness;
+    };
+
+    struct Callbacks
+    {
+        // A peer delivered every block of a piece, with its SHA-1 `digest`.
+        // Not yet verified; call PiecePicker::want() to fetch it again if it
+        // turns out bad.
+        std::function<void(size_t pieceIndex, std::vector<uint8_t> data, std::string digest)> onPiece;
+    };
+
+    // Peers are given the pieces `picker` picks for them. Pieces a peer
+    // drops before finishing are handed back to it as wanted.
+    Swarm(const TorrentFile &torrent, std::string ourPeerId, const Options &options, PiecePicker &picker,
+          Callbacks callbacks);
+
+    // Stops the shards, closing every connection.
+    ~Swarm();
+
+    Swarm(const Swarm &) = delete;
+    Swarm &operator=(const Swarm &) = delete;
+
+    // Adds a peer to connect to as soon as there is room, unless it is
+    // already connected or waiting.
+    void addPeer(std::string ip, int port);
+
+    // Waits up to `timeout` for news from the shards and handles it: pieces
+    // delivered, peers ready for work, peers gone. Then starts new
+    // connections to replace dropped ones. In endgame, call at least a few
+    // times a second so overdue pieces are duplicated promptly. Rethrows
+    // anything a shard thread failed with.
+    void poll(std::chrono::milliseconds timeout);
+
+    // Offers work to every idle peer. Call after marking pieces as wanted
+    // again, e.g. after one failed verification.
+    void assignWork();
+
+    // Connections that are open or still being set up.
+    size_t connectionCount() const { return m_peers.size(); }
+    // Known peers not yet tried.
+    size_t candidateCount() const { return m_candidates.size(); }
+
+    // Every wanted piece is being fetched; idle peers duplicate them.
+    bool inEndgame() const;
+    // Bytes received that were not needed: blocks of pieces another peer
+    // delivered first, and blocks that arrived twice.
+    uint64_t duplicateBytes() const { return m_duplicateBytes; }
+    // Bytes one peer had already received of a piece when another took it
+    // over in endgame; the second peer skipped them instead of fetching
+    // them again.
+    uint64_t handedOverBytes() const { return m_handedOverBytes; }
+
+private:
+    class Shard; // one reactor thread, defined in swarm.cpp
+
+    // What the coordinator and the shards send each other.
+    struct Command
+    {
+        enum class Kind
+        {
+            Connect, // open `peer` to ip:port
+            Assign,  // `peer` should fetch `pieceIndex`, starting from `partial` if set
+            Cancel,  // `peer` should drop `pieceIndex`; someone else delivered it
+            Share,   // `peer` should hand its blocks of `pieceIndex` over to `target`
+            Stop
+        } kind;
+        uint64_t peer;
+        std::string ip;
+        int port = 0;
+        size_t pieceIndex = 0;
+        uint64_t target = 0;
+        std::shared_ptr<PartialPiece> partial;
+
+        Command(Kind kind, uint64_t peer = 0) : kind(kind), peer(peer) {}
+    };
+    struct Event
+    {
+        enum class Kind
+        {
+            Bitfield,  // `peer` has `pieces`
+            Have,      // `peer` has `pieceIndex`
+            Idle,      // `peer` can take a piece
+            Piece,     // `peer` delivered `pieceIndex` as `data`, hashing to `digest`;
+                       // `bytes` of it were handed over
+            Partial,   // `peer` may take `pieceIndex` over from `partial`, if set
+            Rejected,  // an Assign of `pieceIndex` could not be carried out
+            Duplicate, // `peer` received `bytes` that were not needed
+            Closed,    // `peer` is gone, leaving the `unfinished` pieces
+            Failed     // a shard thread stopped on `error`
+        } kind;
+        uint64_t peer;
+        size_t pieceIndex = 0;
+        size_t bytes = 0;
+        std::vector<bool> pieces;
+        std::vector<size_t> unfinished;
+        std::vector<uint8_t> data;
+        std::string digest;
+        std::shared_ptr<PartialPiece> partial;
+        std::string reason;
+        std::exception_ptr error;
+
+        Event(Kind kind, uint64_t peer) : kind(kind), peer(peer) {}
+    };
+
+    // What the coordinator knows about a peer living on some shard.
+    struct RemotePeer
+    {
+        size_t shard;
+        std::string address;
+        std::vector<bool> pieces;
+        bool idle = false; // asked for work and got none yet
+    };
+
+    void handleEvent(Event &event);
+    void offerWork(uint64_t peerId, RemotePeer &peer);
+    std::optional<size_t> pickDuplicate(uint64_t peerId, const RemotePeer &peer) const;
+    void release(uint64_t peerId, size_t pieceIndex);
+    void connectMore();
+
+    const TorrentFile &m_torrent;
+    std::string m_ourPeerId;
+    Options m_options;
+    PiecePicker &m_picker;
+    Callbacks m_callbacks;
+
+    EventLoop m_loop; // only ever woken; the coordinator owns no sockets
+    MpscQueue<Event> m_events;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+
+    std::unordered_map<uint64_t, RemotePeer> m_peers;
+    // Pieces handed out and not yet delivered.
+    struct Download
+    {
+        std::vector<uint64_t> peers; // more than one only in endgame
+        std::chrono::steady_clock::time_point since;
+    };
+    std::unordered_map<size_t, Download> m_downloading;
+    // Average time from handing a piece out to its delivery.
+    std::chrono::steady_clock::duration m_pieceTime{};
+    size_t m_piecesTimed = 0;
+    uint64_t m_duplicateBytes = 0;
+    uint64_t m_handedOverBytes = 0;
+    std::deque<std::pair<std::string, int>> m_candidates;
+    uint64_t m_nextPeerId = 1;
+    size_t m_nextShard = 0;
+};
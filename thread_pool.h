@@ -0,0 +1,43 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef> // For size_t
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads pulling tasks from a shared FIFO queue.
+class ThreadPool
+{
+public:
+    // Starts `threadCount` workers (at least one).
+    explicit ThreadPool(size_t threadCount);
+
+    // Finishes every queued task, then joins the workers.
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Queues a task. Tasks should handle their own errors; an escaping
+    // exception is reported on stderr and otherwise ignored.
+    void submit(std::function<void()> task);
+
+    // Blocks until the queue is empty and no task is running.
+    void wait();
+
+    size_t size() const { return m_workers.size(); }
+
+private:
+    void workerLoop();
+
+    std::vector<std::thread> m_workers;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_taskAvailable;
+    std::condition_variable m_idle;
+    size_t m_running = 0;
+    bool m_stopping = false;
+};
@@ -1,10 +1,13 @@
 #include "torrent_file.h"
 
 // Include necessary implementation headers
-#include <fstream>
+#include <algorithm>
 #include <sstream>
 #include <iostream>
 #include <iomanip>
+#include <stdexcept>
+#include <string_view>
+#include <optional>
 #include "bencode.h" // Your bencode module
 #include "lib/sha1.hpp"
 
@@ -12,7 +15,7 @@
 // This is used for both the info hash and the piece hashes
 namespace
 {
-    std::string bytesToHex(const std::string &bytes)
+    std::string bytesToHex(std::string_view bytes)
     {
         std::ostringstream hexStream;
         hexStream << std::hex << std::setfill('0');
@@ -22,40 +25,72 @@ namespace
         }
         return hexStream.str();
     }
+
+    Bencode::Cursor requireKey(const Bencode::Cursor &dict, std::string_view key)
+    {
+        std::optional<Bencode::Cursor> value = dict.find(key);
+        if (!value)
+        {
+            throw std::runtime_error("Missing '" + std::string(key) + "' key.");
+        }
+        return *value;
+    }
+
+    size_t requireSize(const Bencode::Cursor &dict, std::string_view key)
+    {
+        long long value = requireKey(dict, key).asInteger();
+        if (value < 0)
+        {
+            throw std::runtime_error("Negative '" + std::string(key) + "' value.");
+        }
+        return static_cast<size_t>(value);
+    }
 }
 
 bool TorrentFile::loadFromFile(const std::string &filepath)
 {
-    std::ifstream file(filepath, std::ios::binary);
-    if (!file)
+    m_pieceHashes = std::string_view();
+    if (!m_file.open(filepath))
     {
         std::cerr << "Error: Failed to open file: " << filepath << std::endl;
         return false;
     }
 
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    std::string fileContent = buffer.str();
+    std::string_view fileContent = m_file.view();
 
     try
     {
-        nlohmann::json decodedTorrent = Bencode::decode_bencoded_value(fileContent);
+        // Only the handful of keys below are decoded; everything else in the
+        // file (file lists, comments, web seeds...) is skipped unread.
+        Bencode::Cursor root(fileContent);
+        Bencode::Cursor info = requireKey(root, "info");
 
-        // Bencode the 'info' dictionary to calculate the info hash
-        std::string bencodedInfo = Bencode::json_to_bencode(decodedTorrent["info"]);
+        // Hash the 'info' dictionary exactly as it appears in the file, so
+        // non-canonical key order still yields the info hash peers expect.
+        std::string_view infoBytes = info.raw();
 
         // Calculate info hash (binary and hex)
         SHA1 sha1;
-        sha1.update(bencodedInfo);
-        m_infoHashBinary = sha1.final();
+        sha1.update(infoBytes.data(), infoBytes.size());
+        m_infoHashBinary = sha1.final_bytes();
         m_infoHashHex = bytesToHex(m_infoHashBinary);
 
         // Extract metadata
-        m_trackerUrl = decodedTorrent["announce"].get<std::string>();
-        m_fileLength = decodedTorrent["info"]["length"].get<size_t>();
-        m_pieceLength = decodedTorrent["info"]["piece length"].get<size_t>();
-        m_fileName = decodedTorrent["info"]["name"].get<std::string>();
-        m_pieceHashes = decodedTorrent["info"]["pieces"].get<std::string>();
+        m_trackerUrl = std::string(requireKey(root, "announce").asString());
+        m_fileLength = requireSize(info, "length");
+        m_pieceLength = requireSize(info, "piece length");
+        m_fileName = std::string(requireKey(info, "name").asString());
+        m_pieceHashes = requireKey(info, "pieces").asString();
+
+        // Everything that maps pieces to hashes and byte ranges relies on these.
+        if (m_pieceLength == 0)
+        {
+            throw std::runtime_error("'piece length' must be positive.");
+        }
+        if (m_pieceHashes.size() != getNumPieces() * 20)
+        {
+            throw std::runtime_error("'pieces' does not hold one 20-byte hash per piece.");
+        }
     }
     catch (const std::exception &e)
     {
@@ -87,7 +122,7 @@ void TorrentFile::printInfo() const
 const std::string &TorrentFile::getTrackerUrl() const { return m_trackerUrl; }
 const std::string &TorrentFile::getInfoHashHex() const { return m_infoHashHex; }
 const std::string &TorrentFile::getInfoHashBinary() const { return m_infoHashBinary; }
-const std::string &TorrentFile::getPieceHashes() const { return m_pieceHashes; }
+std::string_view TorrentFile::getPieceHashes() const { return m_pieceHashes; }
 const std::string &TorrentFile::getFileName() const { return m_fileName; }
 size_t TorrentFile::getPieceLength() const { return m_pieceLength; }
 size_t TorrentFile::getFileLength() const { return m_fileLength; }
@@ -96,4 +131,11 @@ size_t TorrentFile::getNumPieces() const
     if (m_pieceLength == 0)
         return 0;
     return (m_fileLength + m_pieceLength - 1) / m_pieceLength;
-}
\ No newline at end of file
+}
+
+size_t TorrentFile::getPieceSize(size_t pieceIndex) const
+{
+    // Every piece is full-length except possibly the last one.
+    size_t offset = pieceIndex * m_pieceLength;
+    return std::min(m_pieceLength, m_fileLength - offset);
+}
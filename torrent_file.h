@@ -1,13 +1,16 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <cstddef> // For size_t
+#include "mapped_file.h"
 
 class TorrentFile
 {
 public:
     // Tries to load and parse a .torrent file. Returns true on success.
+    // The file stays memory-mapped for the lifetime of this object.
     bool loadFromFile(const std::string &filepath);
 
     // Prints all the parsed information to the console for debugging.
@@ -17,17 +20,21 @@ public:
     const std::string &getTrackerUrl() const;
     const std::string &getInfoHashHex() const;
     const std::string &getInfoHashBinary() const;
-    const std::string &getPieceHashes() const;
+    // Concatenated 20-byte SHA-1 hashes, viewed directly in the mapped file.
+    std::string_view getPieceHashes() const;
     const std::string &getFileName() const;
     size_t getPieceLength() const;
     size_t getFileLength() const;
     size_t getNumPieces() const;
+    // Length of one piece; only the last piece can be shorter than getPieceLength().
+    size_t getPieceSize(size_t pieceIndex) const;
 
 private:
+    MappedFile m_file;
     std::string m_trackerUrl;
     std::string m_infoHashHex;
     std::string m_infoHashBinary;
-    std::string m_pieceHashes;
+    std::string_view m_pieceHashes;
     std::string m_fileName;
     size_t m_pieceLength = 0;
     size_t m_fileLength = 0;
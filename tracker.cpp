@@ -6,16 +6,128 @@
 #include <sstream>
 #include <iomanip>
 #include <iostream> // Added for debugging output
+#include <exception>
+#include <string_view>
 
 #include "curl/curl.h"
 
 namespace
 {
+    // Picks the fields we care about out of a tracker response while it is
+    // still arriving. Compact peers are decoded 6 bytes at a time, so the
+    // response body never has to be buffered.
+    class TrackerResponseHandler : public Bencode::EventHandler
+    {
+    public:
+        void beginDict() override { m_depth++; }
+        void beginList() override
+        {
+            if (m_depth == 1 && m_currentKey == "peers")
+            {
+                m_nonCompactPeers = true;
+            }
+            m_depth++;
+        }
+        void end() override { m_depth--; }
+
+        void key(std::string_view key) override
+        {
+            if (m_depth == 1)
+            {
+                m_currentKey = key;
+            }
+        }
+
+        void bytes(std::string_view fragment, size_t) override
+        {
+            if (m_depth != 1)
+            {
+                return;
+            }
+            if (m_currentKey == "peers")
+            {
+                m_sawPeers = true;
+                appendPeerBytes(fragment);
+            }
+            else if (m_currentKey == "failure reason")
+            {
+                m_failureReason.append(fragment);
+                m_sawFailure = true;
+            }
+        }
+
+        // Called from the libcurl callback. Exceptions must not cross the C
+        // boundary, so they are stored and rethrown once the transfer stops.
+        size_t consume(const char *data, size_t length)
+        {
+            try
+            {
+                m_decoder.feed(data, length);
+            }
+            catch (...)
+            {
+                m_error = std::current_exception();
+                return 0; // Makes libcurl abort with CURLE_WRITE_ERROR
+            }
+            return length;
+        }
+
+        void finish()
+        {
+            if (m_error)
+            {
+                std::rethrow_exception(m_error);
+            }
+            m_decoder.finish();
+        }
+
+        bool hasError() const { return static_cast<bool>(m_error); }
+        bool sawFailure() const { return m_sawFailure; }
+        bool sawPeers() const { return m_sawPeers; }
+        bool nonCompactPeers() const { return m_nonCompactPeers; }
+        const std::string &failureReason() const { return m_failureReason; }
+        std::vector<std::string> &peers() { return m_peers; }
+
+    private:
+        void appendPeerBytes(std::string_view fragment)
+        {
+            for (char c : fragment)
+            {
+                m_partialPeer[m_partialSize++] = static_cast<unsigned char>(c);
+                if (m_partialSize < sizeof(m_partialPeer))
+                {
+                    continue;
+                }
+                m_partialSize = 0;
+
+                std::string ip = std::to_string(m_partialPeer[0]) + "." +
+                                 std::to_string(m_partialPeer[1]) + "." +
+                                 std::to_string(m_partialPeer[2]) + "." +
+                                 std::to_string(m_partialPeer[3]);
+
+                uint16_t peerPort = (m_partialPeer[4] << 8) | m_partialPeer[5];
+
+                m_peers.push_back(ip + ":" + std::to_string(peerPort));
+            }
+        }
+
+        Bencode::StreamDecoder m_decoder{*this};
+        std::exception_ptr m_error;
+        int m_depth = 0;
+        std::string m_currentKey;
+        std::string m_failureReason;
+        bool m_sawFailure = false;
+        bool m_sawPeers = false;
+        bool m_nonCompactPeers = false;
+        unsigned char m_partialPeer[6];
+        size_t m_partialSize = 0;
+        std::vector<std::string> m_peers;
+    };
+
     // This is a C-style callback function required by libcurl.
-    size_t writeCallback(void *contents, size_t size, size_t nmemb, std::string *userp)
+    size_t writeCallback(void *contents, size_t size, size_t nmemb, TrackerResponseHandler *userp)
     {
-        userp->append(static_cast<char *>(contents), size * nmemb);
-        return size * nmemb;
+        return userp->consume(static_cast<char *>(contents), size * nmemb);
     }
 
     // Helper to URL-encode the binary info hash and peer ID.
@@ -60,24 +172,22 @@ std::vector<std::string> Tracker::getPeers(const TorrentFile &torrent, const std
         throw std::runtime_error("Failed to initialize CURL");
     }
 
-    std::string responseBuffer;
+    // 3. Decode the Bencoded response as it arrives
+    TrackerResponseHandler response;
     curl_easy_setopt(curl, CURLOPT_URL, url.str().c_str());
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &responseBuffer);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
 
     CURLcode res = curl_easy_perform(curl);
-    if (res != CURLE_OK)
+    curl_easy_cleanup(curl);
+    if (res != CURLE_OK && !response.hasError())
     {
-        curl_easy_cleanup(curl);
         throw std::runtime_error("CURL request failed: " + std::string(curl_easy_strerror(res)));
     }
-    curl_easy_cleanup(curl);
 
-    // 3. Decode the Bencoded response
-    nlohmann::json decodedResponse;
     try
     {
-        decodedResponse = Bencode::decode_bencoded_value(responseBuffer);
+        response.finish();
     }
     catch (const std::exception &e)
     {
@@ -87,33 +197,21 @@ std::vector<std::string> Tracker::getPeers(const TorrentFile &torrent, const std
     // --- DEBUGGING CHANGE ---
     // Check for a "failure reason" key first. If it exists, the tracker
     // is telling us exactly what went wrong.
-    if (decodedResponse.contains("failure reason"))
+    if (response.sawFailure())
     {
-        std::string reason = decodedResponse["failure reason"].get<std::string>();
-        throw std::runtime_error("Tracker error: " + reason);
+        throw std::runtime_error("Tracker error: " + response.failureReason());
     }
 
-    if (!decodedResponse.contains("peers"))
+    if (response.nonCompactPeers())
     {
-        // If there's no failure reason and no peers, print the whole response.
-        throw std::runtime_error("Tracker response missing 'peers' key. Full response: " + decodedResponse.dump());
+        throw std::runtime_error("Tracker returned a non-compact peer list.");
     }
 
-    // 4. Parse the compact peer list
-    std::string peers_str = decodedResponse["peers"].get<std::string>();
-    std::vector<std::string> peerList;
-    for (size_t i = 0; i < peers_str.length(); i += 6)
+    if (!response.sawPeers())
     {
-        std::string ip = std::to_string(static_cast<unsigned char>(peers_str[i])) + "." +
-                         std::to_string(static_cast<unsigned char>(peers_str[i + 1])) + "." +
-                         std::to_string(static_cast<unsigned char>(peers_str[i + 2])) + "." +
-                         std::to_string(static_cast<unsigned char>(peers_str[i + 3]));
-
-        uint16_t peerPort = (static_cast<unsigned char>(peers_str[i + 4]) << 8) |
-                            (static_cast<unsigned char>(peers_str[i + 5]));
-
-        peerList.push_back(ip + ":" + std::to_string(peerPort));
+        throw std::runtime_error("Tracker response missing 'peers' key.");
     }
 
-    return peerList;
+    // 4. The compact peer list was already parsed while streaming
+    return std::move(response.peers());
 }
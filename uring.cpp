@@ -0,0 +1,161 @@
+#include "uring.h"
+
+#ifdef __linux__
+
+#include <algorithm> // For std::max
+#include <cerrno>
+#include <csignal> // For _NSIG
+#include <cstring> // For memset
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+    int ioUringSetup(unsigned entries, io_uring_params *params)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    unsigned *ringField(void *ring, uint32_t offset)
+    {
+        return reinterpret_cast<unsigned *>(static_cast<char *>(ring) + offset);
+    }
+}
+
+Uring::~Uring()
+{
+    destroy();
+}
+
+bool Uring::setup(unsigned entries)
+{
+    destroy();
+
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    m_ringFd = ioUringSetup(entries, &params);
+    if (m_ringFd < 0)
+    {
+        m_ringFd = -1;
+        return false;
+    }
+    m_features = params.features;
+    m_entries = params.sq_entries;
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap)
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+    void *sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+    void *cqRing = singleMap ? sqRing
+                             : mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+    m_sqRing = sqRing != MAP_FAILED ? sqRing : nullptr;
+    m_cqRing = cqRing != MAP_FAILED ? cqRing : nullptr;
+    m_sqes = sqes != MAP_FAILED ? static_cast<io_uring_sqe *>(sqes) : nullptr;
+    if (m_sqRing == nullptr || m_cqRing == nullptr || m_sqes == nullptr)
+    {
+        int error = errno;
+        destroy();
+        errno = error;
+        return false;
+    }
+
+    m_sqHead = ringField(m_sqRing, params.sq_off.head);
+    m_sqTail = ringField(m_sqRing, params.sq_off.tail);
+    m_sqMask = *ringField(m_sqRing, params.sq_off.ring_mask);
+    m_sqArray = ringField(m_sqRing, params.sq_off.array);
+    m_cqHead = ringField(m_cqRing, params.cq_off.head);
+    m_cqTail = ringField(m_cqRing, params.cq_off.tail);
+    m_cqMask = *ringField(m_cqRing, params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe *>(static_cast<char *>(m_cqRing) + params.cq_off.cqes);
+    m_localTail = *m_sqTail;
+    return true;
+}
+
+void Uring::destroy()
+{
+    if (m_sqes != nullptr)
+        munmap(m_sqes, m_sqesSize);
+    if (m_cqRing != nullptr && m_cqRing != m_sqRing)
+        munmap(m_cqRing, m_cqRingSize);
+    if (m_sqRing != nullptr)
+        munmap(m_sqRing, m_sqRingSize);
+    if (m_ringFd != -1)
+        ::close(m_ringFd); // Also drops everything registered with it
+    m_ringFd = -1;
+    m_sqRing = m_cqRing = nullptr;
+    m_sqes = nullptr;
+    m_sqHead = m_sqTail = m_sqArray = m_cqHead = m_cqTail = nullptr;
+    m_cqes = nullptr;
+}
+
+io_uring_sqe *Uring::nextSqe()
+{
+    if (queued() >= m_entries)
+        return nullptr;
+    unsigned slot = m_localTail & m_sqMask;
+    io_uring_sqe *sqe = &m_sqes[slot];
+    std::memset(sqe, 0, sizeof(*sqe));
+    m_sqArray[slot] = slot;
+    ++m_localTail;
+    return sqe;
+}
+
+unsigned Uring::queued() const
+{
+    return m_localTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+}
+
+int Uring::enter(unsigned minComplete, const std::chrono::nanoseconds *timeout)
+{
+    __atomic_store_n(m_sqTail, m_localTail, __ATOMIC_RELEASE);
+    unsigned flags = minComplete > 0 || timeout != nullptr ? IORING_ENTER_GETEVENTS : 0;
+    __kernel_timespec ts{};
+    io_uring_getevents_arg arg{};
+    const void *extra = nullptr;
+    size_t extraSize = 0;
+    if (timeout != nullptr)
+    {
+        ts.tv_sec = std::chrono::duration_cast<std::chrono::seconds>(*timeout).count();
+        ts.tv_nsec = (*timeout % std::chrono::seconds(1)).count();
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        flags |= IORING_ENTER_EXT_ARG;
+        extra = &arg;
+        extraSize = sizeof(arg);
+    }
+    long result = syscall(__NR_io_uring_enter, m_ringFd, queued(), minComplete, flags, extra, extraSize);
+    return result < 0 ? -errno : static_cast<int>(result);
+}
+
+unsigned Uring::dropQueued()
+{
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    unsigned dropped = m_localTail - head;
+    m_localTail = head;
+    __atomic_store_n(m_sqTail, head, __ATOMIC_RELEASE);
+    return dropped;
+}
+
+bool Uring::popCompletion(io_uring_cqe &cqe)
+{
+    unsigned head = *m_cqHead; // Only this thread moves the head
+    if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE))
+        return false;
+    cqe = m_cqes[head & m_cqMask];
+    __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+int Uring::registerResource(unsigned opcode, const void *arg, unsigned count)
+{
+    long result = syscall(__NR_io_uring_register, m_ringFd, opcode, arg, count);
+    return result < 0 ? -errno : static_cast<int>(result);
+}
+
+#endif
@@ -0,0 +1,78 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <chrono>
+#include <cstddef> // For size_t
+#include <linux/io_uring.h>
+
+// A Linux io_uring driven through the raw system calls; glibc has no
+// wrappers for them, and liburing would be one more dependency. Submission
+// entries are filled in place with nextSqe() and handed to the kernel
+// together by enter(); completions are read back with popCompletion().
+// Not thread-safe.
+class Uring
+{
+public:
+    Uring() = default;
+    ~Uring();
+
+    Uring(const Uring &) = delete;
+    Uring &operator=(const Uring &) = delete;
+
+    // Sets up a ring with room for at least `entries` submissions. Returns
+    // false with errno set on failure.
+    bool setup(unsigned entries);
+    void destroy();
+
+    int fd() const { return m_ringFd; }
+    // IORING_FEAT_* bits of the running kernel.
+    unsigned features() const { return m_features; }
+    // Submission queue slots.
+    unsigned entries() const { return m_entries; }
+
+    // A zeroed submission entry to fill in, or nullptr if the submission
+    // queue is full.
+    io_uring_sqe *nextSqe();
+    // Entries filled in but not yet consumed by the kernel.
+    unsigned queued() const;
+
+    // Submits every queued entry and waits until at least `minComplete`
+    // completions are ready, or `timeout` passes if given (which needs
+    // IORING_FEAT_EXT_ARG). Returns io_uring_enter's result, or -errno.
+    int enter(unsigned minComplete, const std::chrono::nanoseconds *timeout = nullptr);
+    // Takes back the entries the kernel has not consumed, e.g. after
+    // enter() failed. Returns how many there were.
+    unsigned dropQueued();
+
+    // Moves the oldest completion into `cqe`; false if there is none.
+    bool popCompletion(io_uring_cqe &cqe);
+
+    // io_uring_register; returns its result, or -errno.
+    int registerResource(unsigned opcode, const void *arg, unsigned count);
+
+private:
+    int m_ringFd = -1;
+    unsigned m_features = 0;
+    unsigned m_entries = 0;
+    void *m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    void *m_cqRing = nullptr; // the same mapping as m_sqRing on kernels with IORING_FEAT_SINGLE_MMAP
+    size_t m_cqRingSize = 0;
+    io_uring_sqe *m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    // Pointers into the ring mappings.
+    unsigned *m_sqHead = nullptr;
+    unsigned *m_sqTail = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned *m_sqArray = nullptr;
+    unsigned *m_cqHead = nullptr;
+    unsigned *m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe *m_cqes = nullptr;
+
+    unsigned m_localTail = 0; // entries filled in so far; published by enter()
+};
+
+#endif
@@ -0,0 +1,197 @@
+#include "uring_storage.h"
+
+#include <iostream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <algorithm> // For std::min
+#include <cerrno>
+#include <cstring> // For strerror
+#include <deque>
+#endif
+
+UringStorage::~UringStorage()
+{
+    close();
+}
+
+void UringStorage::close()
+{
+    destroyRing();
+    FileStorage::close();
+}
+
+void UringStorage::write(uint64_t offset, const void *data, size_t length)
+{
+    writeBatch({WriteRequest{offset, data, length}});
+}
+
+bool UringStorage::open(const std::string &filepath, uint64_t length, AllocationMode mode)
+{
+    close();
+
+    if (!FileStorage::open(filepath, length, mode))
+        return false;
+    if (!setupRing())
+    {
+        FileStorage::close();
+        return false;
+    }
+    return true;
+}
+
+#ifdef __linux__
+
+namespace
+{
+    const unsigned RING_ENTRIES = 64;
+    const size_t MAX_WRITE_LENGTH = size_t(1) << 30; // an SQE length is 32 bits
+}
+
+bool UringStorage::available()
+{
+    static const bool supported = []
+    {
+        Uring ring;
+        // IORING_OP_WRITE arrived in the same release (5.6) as this feature bit.
+        return ring.setup(1) && (ring.features() & IORING_FEAT_RW_CUR_POS) != 0;
+    }();
+    return supported;
+}
+
+bool UringStorage::setupRing()
+{
+    if (!m_ring.setup(RING_ENTRIES))
+    {
+        std::cerr << "Error: Cannot set up io_uring: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    // A registered file saves the kernel a descriptor lookup and reference
+    // count per write. The pieces themselves are written from the caller's
+    // memory: with buffered I/O the kernel copies them into the page cache
+    // anyway, so staging them in registered buffers would only add a copy.
+    int result = m_ring.registerResource(IORING_REGISTER_FILES, &m_fd, 1);
+    if (result < 0)
+    {
+        std::cerr << "Error: Cannot register the output file with io_uring: " << std::strerror(-result) << std::endl;
+        destroyRing();
+        return false;
+    }
+    return true;
+}
+
+void UringStorage::destroyRing()
+{
+    m_ring.destroy(); // Also drops the registered file
+}
+
+void UringStorage::writeBatch(const std::vector<WriteRequest> &requests)
+{
+    struct Pending
+    {
+        uint64_t offset;
+        const char *data;
+        size_t length;
+    };
+    std::vector<Pending> pending;
+    pending.reserve(requests.size());
+    std::deque<size_t> toQueue;
+    for (const WriteRequest &request : requests)
+    {
+        if (request.length == 0)
+            continue;
+        toQueue.push_back(pending.size());
+        pending.push_back({request.offset, static_cast<const char *>(request.data), request.length});
+    }
+
+    std::lock_guard<std::mutex> lock(m_ringMutex);
+    unsigned outstanding = 0; // queued or in the kernel, not yet completed
+    std::string error;
+
+    // The kernel reads the buffers until each write completes, so even after
+    // a failure every outstanding entry is reaped before returning.
+    while ((error.empty() && !toQueue.empty()) || outstanding > 0)
+    {
+        while (error.empty() && !toQueue.empty() && outstanding < m_ring.entries())
+        {
+            size_t index = toQueue.front();
+            toQueue.pop_front();
+            const Pending &write = pending[index];
+
+            io_uring_sqe &sqe = *m_ring.nextSqe(); // outstanding bounds the queued entries
+            sqe.opcode = IORING_OP_WRITE;
+            sqe.flags = IOSQE_FIXED_FILE;
+            sqe.fd = 0; // index into the registered files
+            sqe.off = write.offset;
+            sqe.addr = reinterpret_cast<uint64_t>(write.data);
+            sqe.len = static_cast<uint32_t>(std::min(write.length, MAX_WRITE_LENGTH));
+            sqe.user_data = index;
+            ++outstanding;
+        }
+
+        // One call submits everything queued and waits for at least one completion.
+        int result = m_ring.enter(1);
+        if (result < 0 && result != -EINTR && result != -EAGAIN && result != -EBUSY)
+        {
+            // Take back whatever the kernel did not consume, so only writes
+            // it actually started are waited for below.
+            if (error.empty())
+                error = std::string("io_uring_enter failed: ") + std::strerror(-result);
+            outstanding -= m_ring.dropQueued();
+        }
+
+        io_uring_cqe cqe;
+        while (m_ring.popCompletion(cqe))
+        {
+            size_t index = static_cast<size_t>(cqe.user_data);
+            Pending &write = pending[index];
+            --outstanding;
+
+            if (cqe.res == -EINTR || cqe.res == -EAGAIN)
+            {
+                toQueue.push_back(index);
+            }
+            else if (cqe.res <= 0)
+            {
+                if (error.empty())
+                    error = cqe.res == 0 ? std::string("no progress") : std::strerror(-cqe.res);
+            }
+            else if (static_cast<size_t>(cqe.res) < write.length)
+            {
+                // A short write: queue the rest like any other request.
+                write.offset += static_cast<uint64_t>(cqe.res);
+                write.data += cqe.res;
+                write.length -= static_cast<size_t>(cqe.res);
+                toQueue.push_back(index);
+            }
+        }
+    }
+
+    if (!error.empty())
+    {
+        throw std::runtime_error("Failed to write to output file: " + error);
+    }
+}
+
+#else
+
+bool UringStorage::available()
+{
+    return false;
+}
+
+bool UringStorage::setupRing()
+{
+    std::cerr << "Error: io_uring is only available on Linux." << std::endl;
+    return false;
+}
+
+void UringStorage::destroyRing() {}
+
+void UringStorage::writeBatch(const std::vector<WriteRequest> &requests)
+{
+    FileStorage::writeBatch(requests);
+}
+
+#endif
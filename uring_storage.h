@@ -0,0 +1,39 @@
+#pragma once
+
+#include "storage.h"
+#include "uring.h"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// FileStorage whose writes go through a Linux io_uring: a batch of writes is
+// queued as submission entries against the registered file and handed to the
+// kernel with a single io_uring_enter, instead of one pwrite call each. Reads
+// and syncs are the plain FileStorage ones. Check available() first; on other
+// systems, or kernels without IORING_OP_WRITE (5.6+), open() fails.
+class UringStorage : public FileStorage
+{
+public:
+    UringStorage() = default;
+    ~UringStorage() override;
+
+    // Whether this process can set up a ring that supports file writes.
+    // io_uring may be compiled out, disabled by sysctl or blocked by seccomp.
+    static bool available();
+
+    bool open(const std::string &filepath, uint64_t length, AllocationMode mode = AllocationMode::Sparse) override;
+    void close() override;
+    void write(uint64_t offset, const void *data, size_t length) override;
+    void writeBatch(const std::vector<WriteRequest> &requests) override;
+
+private:
+    bool setupRing();
+    void destroyRing();
+
+    std::mutex m_ringMutex; // one submitter at a time
+#ifdef __linux__
+    Uring m_ring;
+#endif
+};